@@ -1,6 +1,13 @@
-#include <stdio.h>  // fread, fclose, fprintf, stderr
+#include <stdio.h>  // fread, fclose, fileno, fprintf, stderr
 #include <string.h> // strcmp, memcpy
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // sysconf
+#define HAVE_MMAP
+#endif
+
 #include <string>
 #include "glslParser/parser.hpp"
 
@@ -137,7 +144,7 @@ class TUDOTprinter
         const auto dotId = getID();
         const auto dotName = "astGlobalVariable";
         printNode(dotParent,dotId,dotName);
-        std::vector<astLayoutQualifier*> &qualifiers = variable->layoutQualifiers;
+        astArray<astLayoutQualifier*> &qualifiers = variable->layoutQualifiers;
         if (variable->layoutQualifiers.size()) {
             print("layout (");
             for (size_t i = 0; i < qualifiers.size(); i++) {
@@ -700,12 +707,26 @@ int main(int argc, char **argv) {
 
     for (size_t i = 0; i < sources.size(); i++) {
         std::vector<char> contents;
-        // Read contents of file
+        void *mapping = 0;
+        size_t length = 0;
+        // Map the file when possible, the parser does not need the contents
+        // NUL terminated so there is nothing to copy
         if (sources[i].file != stdin) {
-            fseek(sources[i].file, 0, SEEK_END);
-            contents.resize(ftell(sources[i].file));
-            fseek(sources[i].file, 0, SEEK_SET);
-            fread(&contents[0], 1, contents.size(), sources[i].file);
+#if defined(HAVE_MMAP)
+            struct stat info;
+            if (fstat(fileno(sources[i].file), &info) == 0 && info.st_size > 0) {
+                length = info.st_size;
+                mapping = mmap(0, length, PROT_READ, MAP_PRIVATE, fileno(sources[i].file), 0);
+                if (mapping == MAP_FAILED)
+                    mapping = 0;
+            }
+#endif
+            if (!mapping) {
+                fseek(sources[i].file, 0, SEEK_END);
+                contents.resize(ftell(sources[i].file));
+                fseek(sources[i].file, 0, SEEK_SET);
+                contents.resize(fread(contents.data(), 1, contents.size(), sources[i].file));
+            }
             fclose(sources[i].file);
         } else {
             char buffer[1024];
@@ -715,8 +736,23 @@ int main(int argc, char **argv) {
                 contents.insert(contents.end(), buffer, buffer + c);
             }
         }
-        contents.push_back('\0');
-        parser p(&contents[0], sources[i].fileName);
+        // Mappings are zero filled to the end of their last page, which
+        // usually leaves room for the lexer's padding as well
+        bool padded = false;
+#if defined(HAVE_MMAP)
+        if (mapping) {
+            const size_t page = sysconf(_SC_PAGESIZE);
+            padded = length % page && page - length % page >= lexer::kPadding;
+        }
+#endif
+        if (!mapping) {
+            length = contents.size();
+            contents.resize(length + lexer::kPadding, '\0');
+            padded = true;
+        }
+        const char *data = mapping ? (const char *)mapping : contents.data();
+        parser p(data, length, sources[i].fileName);
+        p.setPadded(padded);
         astTU *tu = p.parse(sources[i].shaderType);
         if (tu) {
             TUDOTprinter printer;
@@ -727,6 +763,10 @@ int main(int argc, char **argv) {
         } else {
             fprintf(stderr, "%s\n", p.error());
         }
+#if defined(HAVE_MMAP)
+        if (mapping)
+            munmap(mapping, length);
+#endif
     }
     return 0;
 }
@@ -1,6 +1,13 @@
-#include <stdio.h>  // fread, fclose, fprintf, stderr
+#include <stdio.h>  // fread, fclose, fileno, fprintf, stderr
 #include <string.h> // strcmp, memcpy
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // sysconf
+#define HAVE_MMAP
+#endif
+
 #include "glslParser/parser.hpp"
 
 using namespace glsl;
@@ -65,7 +72,7 @@ static void printBoolConstant(astBoolConstant *expression) {
     print("%s", expression->value ? "true" : "false");
 }
 
-static void printArraySize(const std::vector<astConstantExpression*> &arraySizes) {
+static void printArraySize(const astArray<astConstantExpression*> &arraySizes) {
     for (size_t i = 0; i < arraySizes.size(); i++) {
         print("[");
         printExpression(arraySizes[i]);
@@ -158,7 +165,7 @@ static void printPrecision(int precision) {
 }
 
 static void printGlobalVariable(astGlobalVariable *variable) {
-    std::vector<astLayoutQualifier*> &qualifiers = variable->layoutQualifiers;
+    astArray<astLayoutQualifier*> &qualifiers = variable->layoutQualifiers;
     if (variable->layoutQualifiers.size()) {
         print("layout (");
         for (size_t i = 0; i < qualifiers.size(); i++) {
@@ -595,6 +602,7 @@ struct sourceFile {
 
 int main(int argc, char **argv) {
     int shaderType = -1;
+    size_t bodyThreads = 1;
     std::vector<sourceFile> sources;
     while (argc > 1) {
         ++argv;
@@ -613,6 +621,8 @@ int main(int argc, char **argv) {
                 shaderType = astTU::kGeometry;
             else if (!strcmp(what, "f"))
                 shaderType = astTU::kFragment;
+            else if (!strcmp(what, "j"))
+                bodyThreads = 0; // Function bodies on every core
             else {
                 fprintf(stderr, "unknown option: `%s'\n", argv[0]);
                 return 1;
@@ -641,12 +651,26 @@ int main(int argc, char **argv) {
 
     for (size_t i = 0; i < sources.size(); i++) {
         std::vector<char> contents;
-        // Read contents of file
+        void *mapping = 0;
+        size_t length = 0;
+        // Map the file when possible, the parser does not need the contents
+        // NUL terminated so there is nothing to copy
         if (sources[i].file != stdin) {
-            fseek(sources[i].file, 0, SEEK_END);
-            contents.resize(ftell(sources[i].file));
-            fseek(sources[i].file, 0, SEEK_SET);
-            fread(&contents[0], 1, contents.size(), sources[i].file);
+#if defined(HAVE_MMAP)
+            struct stat info;
+            if (fstat(fileno(sources[i].file), &info) == 0 && info.st_size > 0) {
+                length = info.st_size;
+                mapping = mmap(0, length, PROT_READ, MAP_PRIVATE, fileno(sources[i].file), 0);
+                if (mapping == MAP_FAILED)
+                    mapping = 0;
+            }
+#endif
+            if (!mapping) {
+                fseek(sources[i].file, 0, SEEK_END);
+                contents.resize(ftell(sources[i].file));
+                fseek(sources[i].file, 0, SEEK_SET);
+                contents.resize(fread(contents.data(), 1, contents.size(), sources[i].file));
+            }
             fclose(sources[i].file);
         } else {
             char buffer[1024];
@@ -656,14 +680,34 @@ int main(int argc, char **argv) {
                 contents.insert(contents.end(), buffer, buffer + c);
             }
         }
-        contents.push_back('\0');
-        parser p(&contents[0], sources[i].fileName);
+        // Mappings are zero filled to the end of their last page, which
+        // usually leaves room for the lexer's padding as well
+        bool padded = false;
+#if defined(HAVE_MMAP)
+        if (mapping) {
+            const size_t page = sysconf(_SC_PAGESIZE);
+            padded = length % page && page - length % page >= lexer::kPadding;
+        }
+#endif
+        if (!mapping) {
+            length = contents.size();
+            contents.resize(length + lexer::kPadding, '\0');
+            padded = true;
+        }
+        const char *data = mapping ? (const char *)mapping : contents.data();
+        parser p(data, length, sources[i].fileName);
+        p.setPadded(padded);
+        p.setBodyThreads(bodyThreads);
         astTU *tu = p.parse(sources[i].shaderType);
         if (tu) {
             printTU(tu);
         } else {
             fprintf(stderr, "%s\n", p.error());
         }
+#if defined(HAVE_MMAP)
+        if (mapping)
+            munmap(mapping, length);
+#endif
     }
     return 0;
 }
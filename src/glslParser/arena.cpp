@@ -0,0 +1,123 @@
+#include <stdlib.h> // malloc, free
+
+#include "glslParser/arena.hpp"
+
+namespace glsl {
+
+arena::arena()
+    : m_blocks(0)
+    , m_cursor(0)
+    , m_end(0)
+    , m_blockSize(kInitialBlockSize)
+    , m_blockCount(0)
+{
+}
+
+arena::~arena() {
+    release();
+}
+
+void arena::release() {
+    while (m_blocks) {
+        block *next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+    m_cursor = 0;
+    m_end = 0;
+    m_blockSize = kInitialBlockSize;
+    m_blockCount = 0;
+}
+
+void arena::reset() {
+    if (m_blockCount > 1) {
+        // Only the front of the block being carved from is in use, those
+        // behind it count as full. Sizing by use rather than by the blocks
+        // held keeps an arena which adopts blocks every time from growing
+        // without bound.
+        size_t capacity = m_cursor - ((char *)m_blocks + kHeaderSize);
+        for (block *current = m_blocks->next; current; current = current->next)
+            capacity += current->size;
+        release();
+        block *merged = (block *)malloc(kHeaderSize + capacity);
+        if (!merged)
+            return; // Start over from small blocks
+        merged->next = 0;
+        merged->size = capacity;
+        m_blocks = merged;
+        m_blockCount = 1;
+        m_blockSize = capacity < size_t(kMaxBlockSize) ? capacity : size_t(kMaxBlockSize);
+    }
+    if (m_blocks) {
+        m_cursor = (char *)m_blocks + kHeaderSize;
+        m_end = m_cursor + m_blocks->size;
+    }
+}
+
+void arena::adopt(arena &other) {
+    if (!other.m_blocks || &other == this)
+        return;
+    block *last = other.m_blocks;
+    while (last->next)
+        last = last->next;
+    // Carving goes on from the current block, the adopted ones are full as
+    // far as this arena is concerned
+    if (m_blocks) {
+        last->next = m_blocks->next;
+        m_blocks->next = other.m_blocks;
+    } else {
+        m_blocks = other.m_blocks;
+        m_cursor = other.m_cursor;
+        m_end = other.m_end;
+    }
+    m_blockCount += other.m_blockCount;
+    other.m_blocks = 0;
+    other.m_cursor = 0;
+    other.m_end = 0;
+    other.m_blockSize = kInitialBlockSize;
+    other.m_blockCount = 0;
+}
+
+size_t arena::capacity() const {
+    size_t capacity = 0;
+    for (block *current = m_blocks; current; current = current->next)
+        capacity += current->size;
+    return capacity;
+}
+
+// Slow path of allocate: start a new block, or give an allocation too large
+// to share one a block of its own
+void *arena::allocateBlock(size_t size) {
+    const bool dedicated = size > m_blockSize / 4;
+    const size_t capacity = dedicated ? size : m_blockSize;
+
+    block *next = (block *)malloc(kHeaderSize + capacity);
+    if (!next)
+        return 0;
+    next->size = capacity;
+    m_blockCount++;
+
+    char *data = (char *)next + kHeaderSize;
+    if (dedicated) {
+        // Keep carving from the current block, this one is already full
+        if (m_blocks) {
+            next->next = m_blocks->next;
+            m_blocks->next = next;
+        } else {
+            next->next = 0;
+            m_blocks = next;
+            m_cursor = m_end = data + capacity;
+        }
+        return data;
+    }
+
+    next->next = m_blocks;
+    m_blocks = next;
+    m_cursor = data + size;
+    m_end = data + capacity;
+    if (m_blockSize < kMaxBlockSize)
+        m_blockSize *= 2;
+    return data;
+}
+
+}
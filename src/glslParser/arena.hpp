@@ -0,0 +1,77 @@
+#ifndef ARENA_HDR
+#define ARENA_HDR
+#include <stddef.h> // size_t
+
+namespace glsl {
+
+// A region allocator. Allocations are carved one after another out of large
+// blocks and are only ever released all together, when the arena is reset
+// or destroyed. Blocks grow geometrically so even large parses need only a
+// handful of them.
+struct arena {
+    arena();
+    ~arena();
+
+    // Memory suitably aligned for any AST node or 0 when out of memory
+    void *allocate(size_t size);
+
+    // Release everything allocated so far
+    void release();
+
+    // Discard everything allocated so far but keep the memory for reuse. The
+    // blocks in use are merged into one large enough for what was allocated
+    // since the last reset, so an arena reset between similar workloads
+    // settles on a single block.
+    void reset();
+
+    // Take over the blocks of another arena, which is left empty. What was
+    // allocated from it then lives as long as this arena's own allocations.
+    void adopt(arena &other);
+
+    size_t blocks() const;
+    // Bytes in all blocks, used or not
+    size_t capacity() const;
+
+private:
+    arena(const arena&);
+    arena &operator=(const arena&);
+
+    enum {
+        kAlignment = sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double),
+        kInitialBlockSize = 64 << 10,
+        kMaxBlockSize = 4 << 20
+    };
+
+    struct block {
+        block *next;
+        size_t size;
+    };
+
+    // The header of a block is padded so what follows it stays aligned
+    enum { kHeaderSize = (sizeof(block) + kAlignment - 1) & ~size_t(kAlignment - 1) };
+
+    void *allocateBlock(size_t size);
+
+    block *m_blocks; // Most recent first
+    char *m_cursor;
+    char *m_end;
+    size_t m_blockSize; // Size of the next block
+    size_t m_blockCount;
+};
+
+inline void *arena::allocate(size_t size) {
+    size = (size + kAlignment - 1) & ~size_t(kAlignment - 1);
+    if (size_t(m_end - m_cursor) < size)
+        return allocateBlock(size);
+    void *data = m_cursor;
+    m_cursor += size;
+    return data;
+}
+
+inline size_t arena::blocks() const {
+    return m_blockCount;
+}
+
+}
+
+#endif
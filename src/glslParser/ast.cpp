@@ -1,4 +1,7 @@
+#include <string.h> // memset, strcmp
+
 #include "glslParser/ast.hpp"
+#include "glslParser/lexer.hpp" // kKeyword_*
 
 namespace glsl {
 
@@ -34,7 +37,48 @@ astType::astType(bool builtin)
 astStruct::astStruct()
     : astType(false)
     , name(0)
-{
+    , fieldIndex(0)
+    , fieldIndexSize(0)
+{
+}
+
+bool astStruct::indexFields(arena *memory) {
+    size_t size = 8;
+    while (size < fields.size() * 2)
+        size *= 2;
+    astVariable **index = (astVariable **)memory->allocate(size * sizeof *index);
+    if (!index)
+        return false;
+    memset(index, 0, size * sizeof *index);
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (!fields[i]->name)
+            continue;
+        size_t slot = hashPointer(fields[i]->name) & (size - 1);
+        while (index[slot] && index[slot]->name != fields[i]->name)
+            slot = (slot + 1) & (size - 1);
+        // The first field of a name is the one found
+        if (!index[slot])
+            index[slot] = fields[i];
+    }
+    fieldIndex = index;
+    fieldIndexSize = size;
+    return true;
+}
+
+astVariable *astStruct::findField(const char *name) const {
+    if (fieldIndexSize) {
+        size_t slot = hashPointer(name) & (fieldIndexSize - 1);
+        while (fieldIndex[slot] && fieldIndex[slot]->name != name)
+            slot = (slot + 1) & (fieldIndexSize - 1);
+        if (fieldIndex[slot])
+            return fieldIndex[slot];
+    }
+    // A name which was not interned by the parser misses the index
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i]->name && !strcmp(fields[i]->name, name))
+            return fields[i];
+    }
+    return 0;
 }
 
 astBuiltin::astBuiltin(int type)
@@ -43,6 +87,20 @@ astBuiltin::astBuiltin(int type)
 {
 }
 
+#undef KEYWORD
+#define KEYWORD(X) astBuiltin(kKeyword_##X),
+astBuiltin *astBuiltin::get(int type) {
+    // Indexed by keyword, entries for keywords which aren't typenames are
+    // never handed out. Built on first use, which the language makes safe
+    // across threads.
+    static astBuiltin kTypes[] = {
+        #include "glslParser/lexemes.hpp"
+    };
+    return &kTypes[type];
+}
+#undef KEYWORD
+#define KEYWORD(...)
+
 astVariable::astVariable(int type)
     : name(0)
     , baseType(0)
@@ -102,6 +160,7 @@ astDeclarationStatement::astDeclarationStatement()
 
 astLayoutQualifier::astLayoutQualifier()
     : name(0)
+    , id(-1)
     , initialValue(0)
 {
 }
@@ -109,7 +168,10 @@ astLayoutQualifier::astLayoutQualifier()
 astFunction::astFunction()
     : returnType(0)
     , name(0)
+    , bodyOffset(0)
+    , bodyLength(0)
     , isPrototype(false)
+    , isDeferred(false)
 {
 }
 
@@ -1,45 +1,87 @@
 #ifndef AST_HDR
 #define AST_HDR
-#include <stdlib.h> // free, malloc, size_t
+#include <stddef.h> // size_t
 #include "glslParser/util.hpp"
-#include "glslParser/debug.hpp"
+#include "glslParser/arena.hpp"
 
 namespace glsl {
 
-// Type-erasure
+// Nodes are to inherit from astNode or astCollector
 template <typename T>
-static inline void astDestroy(void *self) {
-    ((T*)self)->~T();
-    free(self);
-}
+struct astNode {
+    void *operator new(size_t size, arena *memory) throw() {
+        return memory->allocate(size);
+    }
+
+	int line;
+	astNode() : line(0) { }
+};
+
+// Stamps the source line on a node once it is constructed. The line is read
+// through a reference after the node's constructor arguments are evaluated,
+// so a node gets the line the parser is at when it is built.
+struct astLine {
+    explicit astLine(const int &line) : m_line(line) { }
 
-struct astMemory {
-    astMemory() : data(0), dtor(0) { }
     template <typename T>
-    astMemory(T *data) : data((void*)data), dtor(&astDestroy<T>) { }
-    void *data;
-    void (*dtor)(void*);
-    void destroy() {
-        dtor(data);
+    T *operator<<(T *node) const {
+        if (node)
+            node->line = m_line;
+        return node;
     }
+
+private:
+    const int &m_line;
 };
 
-// Nodes are to inherit from astNode or astCollector
+// A growable array of child nodes kept in arena memory. It has no destructor,
+// storage outgrown while appending is left behind in the arena to be
+// released with everything else.
 template <typename T>
-struct astNode {
-    void *operator new(size_t size, std::vector<astMemory> *collector) throw() {
-        void *data = malloc(size);
-        if (data)
-            collector->push_back(astMemory((T*)data));
-        return data;
+struct astArray {
+    astArray() : m_data(0), m_size(0), m_capacity(0) { }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T &operator[](size_t index) { return m_data[index]; }
+    const T &operator[](size_t index) const { return m_data[index]; }
+    T &back() { return m_data[m_size - 1]; }
+    void pop_back() { m_size--; }
+    void clear() { m_size = 0; }
+
+    // Both return false when out of memory, leaving the array as it was
+    bool push_back(arena *memory, const T &value) {
+        if (m_size == m_capacity && !reserve(memory, m_capacity ? m_capacity * 2 : 4))
+            return false;
+        m_data[m_size++] = value;
+        return true;
     }
 
-	int line;
-	astNode() {
-		line = debug::inst().getLine();
-	}
-};
+    bool assign(arena *memory, const std::vector<T> &values) {
+        if (values.size() > m_capacity && !reserve(memory, values.size()))
+            return false;
+        for (size_t i = 0; i < values.size(); i++)
+            m_data[i] = values[i];
+        m_size = values.size();
+        return true;
+    }
+
+private:
+    bool reserve(arena *memory, size_t capacity) {
+        T *data = (T*)memory->allocate(capacity * sizeof(T));
+        if (!data)
+            return false;
+        for (size_t i = 0; i < m_size; i++)
+            data[i] = m_data[i];
+        m_data = data;
+        m_capacity = capacity;
+        return true;
+    }
 
+    T *m_data;
+    size_t m_size;
+    size_t m_capacity;
+};
 
 struct astFunction;
 struct astType;
@@ -52,6 +94,9 @@ struct astVariable;
 
 struct astTU {
     astTU(int type);
+    void *operator new(size_t size, arena *memory) throw() {
+        return memory->allocate(size);
+    }
 
     enum {
         kCompute,
@@ -62,9 +107,9 @@ struct astTU {
         kFragment
     };
 
-    std::vector<astFunction*> functions;
-    std::vector<astGlobalVariable*> globals;
-    std::vector<astStruct*> structures;
+    astArray<astFunction*> functions;
+    astArray<astGlobalVariable*> globals;
+    astArray<astStruct*> structures;
 
     int type;
 
@@ -81,12 +126,23 @@ struct astType : astNode<astType> {
 struct astBuiltin : astType {
     astBuiltin(int type);
     int type; // kKeyword_*
+
+    // The one node of a builtin type, shared by every AST. It must never be
+    // modified.
+    static astBuiltin *get(int type);
 };
 
 struct astStruct : astType {
     astStruct();
     char *name;
-    std::vector<astVariable*> fields;
+    astArray<astVariable*> fields;
+
+    // Fields are looked up through an open-addressed index by interned name
+    // once indexFields has built it, and by comparing names otherwise
+    bool indexFields(arena *memory);
+    astVariable *findField(const char *name) const;
+    astVariable **fieldIndex;
+    size_t fieldIndexSize;
 };
 
 typedef astExpression astConstantExpression;
@@ -110,7 +166,7 @@ struct astVariable : astNode<astVariable> {
     bool isArray;
     bool isPrecise;
     int type;
-    std::vector<astConstantExpression *> arraySizes;
+    astArray<astConstantExpression*> arraySizes;
 };
 
 struct astFunctionVariable : astVariable {
@@ -171,12 +227,60 @@ struct astGlobalVariable : astVariable {
     int interpolation;
     bool isInvariant;
     astConstantExpression *initialValue;
-    std::vector<astLayoutQualifier*> layoutQualifiers;
+    astArray<astLayoutQualifier*> layoutQualifiers;
+};
+
+// Layout qualifiers
+enum {
+    kLayout_shared,
+    kLayout_packed,
+    kLayout_std140,
+    kLayout_row_major,
+    kLayout_column_major,
+    kLayout_binding,
+    kLayout_offset,
+    kLayout_align,
+    kLayout_location,
+    kLayout_component,
+    kLayout_index,
+    kLayout_triangles,
+    kLayout_quads,
+    kLayout_isolines,
+    kLayout_equal_spacing,
+    kLayout_fractional_even_spacing,
+    kLayout_fractional_odd_spacing,
+    kLayout_cw,
+    kLayout_ccw,
+    kLayout_point_mode,
+    kLayout_points,
+    kLayout_lines,
+    kLayout_lines_adjacency,
+    kLayout_triangles_adjacency,
+    kLayout_invocations,
+    kLayout_origin_upper_left,
+    kLayout_pixel_center_integer,
+    kLayout_early_fragment_tests,
+    kLayout_local_size_x,
+    kLayout_local_size_y,
+    kLayout_local_size_z,
+    kLayout_xfb_buffer,
+    kLayout_xfb_stride,
+    kLayout_xfb_offset,
+    kLayout_vertices,
+    kLayout_line_strip,
+    kLayout_triangle_strip,
+    kLayout_max_vertices,
+    kLayout_stream,
+    kLayout_depth_any,
+    kLayout_depth_greater,
+    kLayout_depth_less,
+    kLayout_depth_unchanged
 };
 
 struct astLayoutQualifier : astNode<astLayoutQualifier> {
     astLayoutQualifier();
     char *name;
+    int id; // kLayout_*
     astConstantExpression *initialValue;
 };
 
@@ -184,9 +288,13 @@ struct astFunction : astNode<astFunction> {
     astFunction();
     astType *returnType;
     char *name;
-    std::vector<astFunctionParameter*> parameters;
-    std::vector<astStatement*> statements;
+    astArray<astFunctionParameter*> parameters;
+    astArray<astStatement*> statements;
+    // The body in the source, from its `{' to its `}'
+    size_t bodyOffset;
+    size_t bodyLength;
     bool isPrototype;
+    bool isDeferred; // Statements not parsed yet, see parser::parseBody
 };
 
 struct astDeclaration : astNode<astDeclaration> {
@@ -222,7 +330,7 @@ struct astSimpleStatement : astStatement {
 
 struct astCompoundStatement : astStatement {
     astCompoundStatement();
-    std::vector<astStatement*> statements;
+    astArray<astStatement*> statements;
 };
 
 struct astEmptyStatement : astSimpleStatement {
@@ -231,7 +339,7 @@ struct astEmptyStatement : astSimpleStatement {
 
 struct astDeclarationStatement : astSimpleStatement {
     astDeclarationStatement();
-    std::vector<astFunctionVariable*> variables;
+    astArray<astFunctionVariable*> variables;
 };
 
 struct astExpressionStatement : astSimpleStatement {
@@ -249,7 +357,7 @@ struct astIfStatement : astSimpleStatement {
 struct astSwitchStatement : astSimpleStatement {
     astSwitchStatement();
     astExpression *expression;
-    std::vector<astStatement*> statements;
+    astArray<astStatement*> statements;
 };
 
 struct astCaseLabelStatement : astSimpleStatement {
@@ -378,13 +486,13 @@ struct astArraySubscript : astExpression {
 struct astFunctionCall : astExpression {
     astFunctionCall();
     char *name;
-    std::vector<astExpression*> parameters;
+    astArray<astExpression*> parameters;
 };
 
 struct astConstructorCall : astExpression {
     astConstructorCall();
     astType *type;
-    std::vector<astExpression*> parameters;
+    astArray<astExpression*> parameters;
 };
 
 struct astUnaryExpression : astExpression {
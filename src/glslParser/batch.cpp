@@ -0,0 +1,131 @@
+#include <string.h> // memcpy, strlen
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "glslParser/batch.hpp"
+#include "glslParser/parser.hpp"
+
+namespace glsl {
+
+struct parseBatch::worker {
+    worker()
+        : instance(0, 0, 0, &memory, &atoms)
+        , begin(0)
+        , end(0)
+    {
+    }
+
+    arena memory;
+    internTable atoms;
+    parser instance; // Reset for every job so its tables are reused
+    std::mutex lock; // Guards begin and end
+    size_t begin; // Jobs [begin, end) are yet to be taken
+    size_t end;
+};
+
+parseBatch::parseBatch(size_t threads) {
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (!threads)
+        threads = 1;
+    for (size_t i = 0; i < threads; i++)
+        m_workers.push_back(new worker);
+}
+
+parseBatch::~parseBatch() {
+    for (size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i];
+}
+
+size_t parseBatch::threads() const {
+    return m_workers.size();
+}
+
+void parseBatch::parse(const std::vector<parseJob> &jobs, std::vector<parseResult> &results) {
+    results.assign(jobs.size(), parseResult());
+
+    // Hand every worker an equal run of the jobs up front
+    const size_t count = m_workers.size() < jobs.size() ? m_workers.size() : jobs.size();
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        worker *current = m_workers[i];
+        current->memory.reset();
+        current->begin = i < count ? jobs.size() * i / count : 0;
+        current->end = i < count ? jobs.size() * (i + 1) / count : 0;
+    }
+
+    // The calling thread is the first worker. Should fewer threads start,
+    // the runs of the others are left for it to steal.
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    try {
+        for (size_t i = 1; i < count; i++)
+            threads.push_back(std::thread(&parseBatch::run, this, i, std::cref(jobs), std::ref(results)));
+    } catch (const std::system_error &) {
+    }
+    if (count)
+        run(0, jobs, results);
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+/// run
+void parseBatch::run(size_t index, const std::vector<parseJob> &jobs, std::vector<parseResult> &results) {
+    worker *current = m_workers[index];
+    size_t job = 0;
+    while (take(index, job) || steal(index, job)) {
+        const parseJob &work = jobs[job];
+        parseResult &result = results[job];
+        parser &p = current->instance;
+        p.reset(work.source, work.length, work.fileName);
+        result.ast = p.parse(work.type);
+        if (result.ast)
+            continue;
+        // The parser owns its error, keep a copy along with the other results
+        const char *error = p.error() ? p.error() : "parse failed";
+        const size_t length = strlen(error);
+        char *copy = (char *)current->memory.allocate(length + 1);
+        if (copy)
+            memcpy(copy, error, length + 1);
+        result.error = copy ? copy : "Out of memory";
+    }
+}
+
+/// take
+bool parseBatch::take(size_t index, size_t &job) {
+    worker *current = m_workers[index];
+    std::lock_guard<std::mutex> guard(current->lock);
+    if (current->begin == current->end)
+        return false;
+    job = current->begin++;
+    return true;
+}
+
+/// steal
+bool parseBatch::steal(size_t index, size_t &job) {
+    // Jobs are always in some worker's run or being parsed, so once every
+    // other run is found empty there is nothing left to steal
+    for (size_t i = 1; i < m_workers.size(); i++) {
+        worker *victim = m_workers[(index + i) % m_workers.size()];
+        size_t begin = 0;
+        size_t end = 0;
+        {
+            std::lock_guard<std::mutex> guard(victim->lock);
+            if (victim->begin == victim->end)
+                continue;
+            // Take the back half, which the victim would get to last
+            begin = victim->begin + (victim->end - victim->begin) / 2;
+            end = victim->end;
+            victim->end = begin;
+        }
+        worker *current = m_workers[index];
+        std::lock_guard<std::mutex> guard(current->lock);
+        job = begin;
+        current->begin = begin + 1;
+        current->end = end;
+        return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef BATCH_HDR
+#define BATCH_HDR
+#include <stddef.h> // size_t
+#include <vector>
+
+#include "glslParser/ast.hpp"
+
+namespace glsl {
+
+struct parseJob {
+    const char *source; // Need not be NUL terminated
+    size_t length;
+    int type; // astTU::kVertex, astTU::kFragment, ...
+    const char *fileName;
+};
+
+struct parseResult {
+    astTU *ast; // 0 when the parse failed
+    const char *error; // Set when the parse failed
+};
+
+// Parses many independent sources on a pool of threads. Every worker has a
+// parser of its own which allocates from the worker's arena and interns
+// names in the worker's table, all of which are kept from one batch to the
+// next. Jobs are handed out to the workers in contiguous runs and a worker
+// which runs out steals half of what another one has left.
+struct parseBatch {
+    // One worker per hardware thread when `threads' is 0
+    parseBatch(size_t threads = 0);
+    ~parseBatch();
+
+    // Parses every job, results[i] is that of jobs[i]. The sources and file
+    // names must stay alive as long as the results are used, which remain
+    // valid until the next call or until the batch is destroyed.
+    void parse(const std::vector<parseJob> &jobs, std::vector<parseResult> &results);
+
+    size_t threads() const;
+
+private:
+    parseBatch(const parseBatch&);
+    parseBatch &operator=(const parseBatch&);
+
+    struct worker;
+
+    void run(size_t index, const std::vector<parseJob> &jobs, std::vector<parseResult> &results);
+    bool take(size_t index, size_t &job);
+    bool steal(size_t index, size_t &job);
+
+    std::vector<worker*> m_workers;
+};
+
+}
+
+#endif
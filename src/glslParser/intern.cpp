@@ -0,0 +1,105 @@
+#include <string.h> // memcpy, memcmp
+#include <new>      // placement new
+
+#include "glslParser/intern.hpp"
+#include "glslParser/util.hpp"
+
+namespace glsl {
+
+internTable::internTable()
+    : m_table(0)
+    , m_count(0)
+{
+}
+
+size_t internTable::size() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+// The atom equal to the string or 0, in which case `slot' is the empty slot
+// where it would go
+const char *internTable::find(const table *atoms, const char *data, size_t length, unsigned hash, size_t &slot) {
+    slot = hash & atoms->mask;
+    for (;;) {
+        const char *atom = atoms->slots[slot].load(std::memory_order_acquire);
+        if (!atom)
+            return 0;
+        const header *info = (const header *)atom - 1;
+        if (info->hash == hash && info->length == length && !memcmp(atom, data, length))
+            return atom;
+        slot = (slot + 1) & atoms->mask;
+    }
+}
+
+const char *internTable::intern(const char *data, size_t length) {
+    const unsigned hash = hashString(data, length);
+    size_t slot = 0;
+
+    // Lock free when the string is already interned
+    const table *atoms = m_table.load(std::memory_order_acquire);
+    if (atoms) {
+        if (const char *atom = find(atoms, data, length, hash, slot))
+            return atom;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    table *current = m_table.load(std::memory_order_relaxed);
+    if (current) {
+        // Someone may have added it or grown the table in the meantime
+        if (const char *atom = find(current, data, length, hash, slot))
+            return atom;
+    }
+
+    const size_t count = m_count.load(std::memory_order_relaxed);
+    if (!current || (count + 1) * 2 > current->mask + 1) {
+        if (!(current = grow(current)))
+            return 0;
+        find(current, data, length, hash, slot);
+    }
+
+    header *info = (header *)m_memory.allocate(sizeof(header) + length + 1);
+    if (!info)
+        return 0;
+    info->hash = hash;
+    info->length = unsigned(length);
+    char *atom = (char *)(info + 1);
+    memcpy(atom, data, length);
+    atom[length] = '\0';
+
+    // Publishing the slot makes the atom's contents visible to readers
+    current->slots[slot].store(atom, std::memory_order_release);
+    m_count.store(count + 1, std::memory_order_relaxed);
+    return atom;
+}
+
+// Copy everything into a table twice the size and publish it, the old one
+// stays valid for whoever is still reading it
+internTable::table *internTable::grow(const table *atoms) {
+    const size_t size = atoms ? (atoms->mask + 1) * 2 : 256;
+    table *next = (table *)m_memory.allocate(sizeof(table));
+    void *slots = m_memory.allocate(size * sizeof(std::atomic<const char *>));
+    if (!next || !slots)
+        return 0;
+    next->mask = size - 1;
+    next->slots = (std::atomic<const char *> *)slots;
+    for (size_t i = 0; i < size; i++)
+        new (&next->slots[i]) std::atomic<const char *>((const char *)0);
+
+    if (atoms) {
+        for (size_t i = 0; i <= atoms->mask; i++) {
+            const char *atom = atoms->slots[i].load(std::memory_order_relaxed);
+            if (!atom)
+                continue;
+            const header *info = (const header *)atom - 1;
+            size_t slot = info->hash & next->mask;
+            while (next->slots[slot].load(std::memory_order_relaxed))
+                slot = (slot + 1) & next->mask;
+            next->slots[slot].store(atom, std::memory_order_relaxed);
+        }
+    }
+
+    m_table.store(next, std::memory_order_release);
+    return next;
+}
+
+}
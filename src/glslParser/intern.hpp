@@ -0,0 +1,54 @@
+#ifndef INTERN_HDR
+#define INTERN_HDR
+#include <stddef.h> // size_t
+#include <atomic>
+#include <mutex>
+
+#include "glslParser/arena.hpp"
+
+namespace glsl {
+
+// Interned identifiers. Every distinct string gets a single stable, NUL
+// terminated copy so interned strings are equal exactly when their
+// addresses are. One table may be shared by any number of parsers on any
+// number of threads: finding a string which is already interned takes no
+// lock, only adding a new one does.
+struct internTable {
+    internTable();
+
+    // The interned copy of the string or 0 when out of memory
+    const char *intern(const char *data, size_t length);
+
+    // Number of distinct strings interned
+    size_t size() const;
+
+private:
+    internTable(const internTable&);
+    internTable &operator=(const internTable&);
+
+    // Each atom is preceded by its hash and length
+    struct header {
+        unsigned hash;
+        unsigned length;
+    };
+
+    // Open-addressed and at most half full. Slots are only ever filled in,
+    // and a table which is outgrown stays in the arena for readers which may
+    // still be probing it.
+    struct table {
+        size_t mask;
+        std::atomic<const char *> *slots;
+    };
+
+    static const char *find(const table *atoms, const char *data, size_t length, unsigned hash, size_t &slot);
+    table *grow(const table *atoms);
+
+    std::atomic<table *> m_table;
+    std::atomic<size_t> m_count;
+    std::mutex m_lock; // Held while adding
+    arena m_memory; // Atoms and tables live here
+};
+
+}
+
+#endif
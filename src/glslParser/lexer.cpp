@@ -1,11 +1,23 @@
-#include <string.h> // memset, strlen
-#include <stdlib.h> // malloc, free
+#include <string.h> // memset, memcpy, strlen
+#include <stdlib.h> // malloc, free, strtod, strtof
 #include <limits.h> // INT_MAX, UINT_MAX
+#include <float.h>  // FLT_EVAL_METHOD
 #include <assert.h>
 
-#include "glslParser/debug.hpp"
 #include "glslParser/lexer.hpp"
 
+// Whitespace and comments are skipped a chunk at a time where possible
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define GLSL_LEXER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define GLSL_LEXER_SSE2
+#endif
+#if defined(GLSL_LEXER_AVX2) || defined(GLSL_LEXER_SSE2)
+#   define GLSL_LEXER_SIMD
+#endif
+
 namespace glsl {
 
 // Lookup table of keywords
@@ -17,6 +29,12 @@ static const keywordInfo kKeywords[] = {
 #undef KEYWORD
 #define KEYWORD(...)
 
+// Keywords are classified with a perfect hash built once from the table above
+static int findKeyword(const char *data, size_t length, unsigned hash) {
+    static const perfectHash kKeywordHash(kKeywords, sizeof(kKeywords)/sizeof(kKeywords[0]), &keywordInfo::name);
+    return kKeywordHash.find(data, length, hash);
+}
+
 // Lookup table of operators
 #undef OPERATOR
 #define OPERATOR(X, S, PREC) { #X, S, PREC },
@@ -26,6 +44,54 @@ static const operatorInfo kOperators[] = {
 #undef OPERATOR
 #define OPERATOR(...)
 
+// The operator DFA has one state per distinct operator prefix, which can be
+// no more than all operator characters combined, plus the start state
+#undef OPERATOR
+#define OPERATOR(X, S, PREC) + (sizeof(S) - 1)
+enum { kOperatorStates = 1
+    #include "glslParser/lexemes.hpp"
+};
+#undef OPERATOR
+#define OPERATOR(...)
+
+// A DFA recognizing every operator in the table above. Bytes are first
+// mapped to columns so the transition table only needs as many columns
+// as there are distinct operator characters. State and column zero both
+// mean "none", state zero also being where every match starts.
+struct operatorMachine {
+    operatorMachine();
+    unsigned char columns[256];
+    unsigned char next[kOperatorStates][kOperatorStates];
+    signed char accepts[kOperatorStates]; // Operator a state accepts or -1
+};
+
+// Columns number no more than states, so both fit the byte wide tables
+static_assert(kOperatorStates <= 256, "operator states no longer fit in unsigned char");
+static_assert(sizeof(kOperators)/sizeof(kOperators[0]) <= 127, "operators no longer fit in signed char");
+
+operatorMachine::operatorMachine() {
+    memset(columns, 0, sizeof columns);
+    memset(next, 0, sizeof next);
+    memset(accepts, -1, sizeof accepts);
+    size_t columnCount = 1;
+    size_t stateCount = 1;
+    for (size_t i = 0; i < sizeof(kOperators)/sizeof(kOperators[0]); i++) {
+        size_t state = 0;
+        for (const char *ch = kOperators[i].string; *ch; ch++) {
+            unsigned char &column = columns[(unsigned char)*ch];
+            if (!column)
+                column = (unsigned char)columnCount++;
+            unsigned char &to = next[state][column];
+            if (!to)
+                to = (unsigned char)stateCount++;
+            state = to;
+        }
+        accepts[state] = (signed char)i;
+    }
+}
+
+static const operatorMachine kOperatorMachine;
+
 token::token() {
     memset(this, 0, sizeof *this);
 }
@@ -81,6 +147,70 @@ double token::getAsDouble() const
     return asDouble;
 }
 
+size_t token::getOffset() const
+{
+    return m_offset;
+}
+
+size_t token::getLength() const
+{
+    return m_length;
+}
+
+/// tokenStream
+tokenStream::tokenStream()
+    : m_error(0)
+{
+}
+
+token tokenStream::operator[](size_t index) const {
+    token value;
+    value.m_type = m_types[index];
+    value.m_offset = m_offsets[index];
+    value.m_length = m_lengths[index];
+    const payload &data = m_payloads[index];
+    switch (value.m_type) {
+    case kType_keyword:         value.asKeyword = data.asKeyword;   break;
+    case kType_constant_int:    value.asInt = data.asInt;           break;
+    case kType_constant_uint:   value.asUnsigned = data.asUnsigned; break;
+    case kType_constant_float:  value.asFloat = data.asFloat;       break;
+    case kType_constant_double: value.asDouble = data.asDouble;     break;
+    case kType_operator:        value.asOperator = data.asOperator; break;
+    }
+    return value;
+}
+
+const char *tokenStream::error() const {
+    return m_error;
+}
+
+void tokenStream::clear() {
+    m_types.clear();
+    m_payloads.clear();
+    m_offsets.clear();
+    m_lengths.clear();
+    m_lines.clear();
+    m_error = 0;
+}
+
+void tokenStream::push(const token &value, size_t line) {
+    payload data;
+    data.asDouble = 0.0;
+    switch (value.m_type) {
+    case kType_keyword:         data.asKeyword = value.asKeyword;   break;
+    case kType_constant_int:    data.asInt = value.asInt;           break;
+    case kType_constant_uint:   data.asUnsigned = value.asUnsigned; break;
+    case kType_constant_float:  data.asFloat = value.asFloat;       break;
+    case kType_constant_double: data.asDouble = value.asDouble;     break;
+    case kType_operator:        data.asOperator = value.asOperator; break;
+    }
+    m_types.push_back((unsigned char)value.m_type);
+    m_payloads.push_back(data);
+    m_offsets.push_back(unsigned(value.m_offset));
+    m_lengths.push_back(unsigned(value.m_length));
+    m_lines.push_back(unsigned(line));
+}
+
 /// location
 location::location()
     : column(1)
@@ -100,186 +230,259 @@ void location::advanceLine() {
     column = 1;
 }
 
+void location::advanceTo(size_t end, size_t newlines, size_t lastNewline) {
+    if (newlines) {
+        line += newlines;
+        column = end - lastNewline;
+    } else {
+        column += end - position;
+    }
+    position = end;
+}
+
+// Bit scanning helpers for the vectorized paths below
+static inline unsigned countBits(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+#endif
+}
+
+static inline unsigned lowestBit(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    unsigned index = 0;
+    for (; !(mask & 1); mask >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+static inline unsigned highestBit(unsigned mask) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(mask);
+#else
+    unsigned index = 0;
+    while (mask >>= 1)
+        index++;
+    return index;
+#endif
+}
+
+// Masks over a chunk of source, one bit per byte
+#if defined(GLSL_LEXER_AVX2)
+enum { kChunkSize = 32 };
+static const unsigned kChunkMask = 0xFFFFFFFFu;
+
+static inline __m256i loadChunk(const char *data) {
+    return _mm256_loadu_si256((const __m256i *)data);
+}
+
+static inline unsigned maskEqual(const char *data, char ch) {
+    return unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(loadChunk(data), _mm256_set1_epi8(ch))));
+}
+
+static inline unsigned maskSpace(const char *data) {
+    // (ch - '\t') <= '\r' - '\t' as unsigned, or ch == ' '
+    const __m256i chunk = loadChunk(data);
+    const __m256i control = _mm256_sub_epi8(chunk, _mm256_set1_epi8('\t'));
+    const __m256i isControl = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+    const __m256i isBlank = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+    return unsigned(_mm256_movemask_epi8(_mm256_or_si256(isControl, isBlank)));
+}
+#elif defined(GLSL_LEXER_SSE2)
+enum { kChunkSize = 16 };
+static const unsigned kChunkMask = 0xFFFFu;
+
+static inline __m128i loadChunk(const char *data) {
+    return _mm_loadu_si128((const __m128i *)data);
+}
+
+static inline unsigned maskEqual(const char *data, char ch) {
+    return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(loadChunk(data), _mm_set1_epi8(ch))));
+}
+
+static inline unsigned maskSpace(const char *data) {
+    // (ch - '\t') <= '\r' - '\t' as unsigned, or ch == ' '
+    const __m128i chunk = loadChunk(data);
+    const __m128i control = _mm_sub_epi8(chunk, _mm_set1_epi8('\t'));
+    const __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+    const __m128i isBlank = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+    return unsigned(_mm_movemask_epi8(_mm_or_si128(isControl, isBlank)));
+}
+#endif
+
+// Character classes, one lookup instead of chained range checks
+enum {
+    kClassSpace = 1 << 0,
+    kClassDigit = 1 << 1,
+    kClassOctal = 1 << 2,
+    kClassHex = 1 << 3,
+    kClassAlpha = 1 << 4,
+    kClassIdentifier = 1 << 5
+};
+
+#define _ 0
+#define S kClassSpace
+#define O (kClassDigit | kClassOctal | kClassHex | kClassIdentifier)
+#define D (kClassDigit | kClassHex | kClassIdentifier)
+#define X (kClassHex | kClassAlpha | kClassIdentifier)
+#define A (kClassAlpha | kClassIdentifier)
+#define U kClassIdentifier
+static const unsigned char kCharClasses[256] = {
+    _, _, _, _, _, _, _, _, _, S, S, S, S, S, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    S, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    O, O, O, O, O, O, O, O, D, D, _, _, _, _, _, _,
+    _, X, X, X, X, X, X, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, _, _, _, _, U,
+    _, X, X, X, X, X, X, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+    _, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+};
+#undef _
+#undef S
+#undef O
+#undef D
+#undef X
+#undef A
+#undef U
+
+static inline bool isClass(int ch, int classes) {
+    return kCharClasses[(unsigned char)ch] & classes;
+}
+
 static inline bool isDigit(int ch) {
-    return unsigned(ch) - '0' < 10;
+    return isClass(ch, kClassDigit);
 }
 
 static inline bool isChar(int ch) {
-    return (unsigned(ch) | 32) - 'a' < 26;
+    return isClass(ch, kClassAlpha);
 }
 
 static inline bool isOctal(int ch) {
-    return unsigned(ch) - '0' < 8;
+    return isClass(ch, kClassOctal);
 }
 
 static inline bool isHex(int ch) {
-    return (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F') || isDigit(ch);
+    return isClass(ch, kClassHex);
 }
 
 static inline bool isSpace(int ch) {
-    return (ch >= '\t' && ch <= '\r') || ch == ' ';
+    return isClass(ch, kClassSpace);
+}
+
+static inline bool isIdentifier(int ch) {
+    return isClass(ch, kClassIdentifier);
 }
 
 lexer::lexer(const char *string)
+    : lexer(string, string ? strlen(string) : 0)
+{
+}
+
+// Offsets and lengths in a tokenStream are 32 bits
+static const char *checkLength(size_t length) {
+    return length > UINT_MAX ? "source is too large, the limit is 4 GiB" : 0;
+}
+
+lexer::lexer(const char *string, size_t length)
     : m_data(string)
-    , m_length(0)
-    , m_error(0)
+    , m_length(length)
+    , m_error(checkLength(length))
+    , m_zeroCopy(false)
+    , m_padded(false)
+    , m_lookaheadHead(0)
+    , m_lookaheadCount(0)
 {
-    if (m_data)
-        m_length = strlen(m_data);
 }
 
-int lexer::at(int offset) const {
-    if (position() + offset < m_length)
-        return m_data[position() + offset];
-    return 0;
+void lexer::reset(const char *data, size_t length) {
+    m_data = data;
+    m_length = length;
+    m_error = checkLength(length);
+    m_padded = false;
+    m_location = location();
+    m_backup = location();
+    m_lookaheadHead = 0;
+    m_lookaheadCount = 0;
+}
+
+void lexer::setZeroCopy(bool enable) {
+    m_zeroCopy = enable;
+}
+
+void lexer::setPadded(bool enable) {
+    m_padded = enable;
+}
+
+const char *lexer::identifier(const token &identifier) const {
+    return m_data + identifier.m_offset;
 }
 
 void lexer::read(token &out) {
     // Any previous identifier must be freed
-    if (out.m_type == kType_identifier)
+    if (out.m_type == kType_identifier && !m_zeroCopy)
         free(out.asIdentifier);
 
+    out.m_offset = position();
+    scan(out);
+    out.m_length = position() - out.m_offset;
+}
+
+void lexer::scan(token &out) {
     // TODO: Line continuation (backslash `\'.)
     if (position() == m_length) {
         out.m_type = kType_eof;
         return;
     }
 
-    int ch1 = at(1);
-    int ch2 = at(2);
-
     // Lex numerics
-    if (isDigit(at()) || (at() == '.' && isDigit(ch1)))
+    if (isDigit(at()) || (at() == '.' && isDigit(at(1))))
     {
-        bool isFloat = false;
-        bool isDouble = false;
-        bool isUnsigned = false;
-        bool isOctalish = false;
-        bool isHexish = false;
-
-        if (at() == '0') {
-            if (ch1 && (ch1 == 'x' || ch1 == 'X')) {
-                isHexish = true;
-                m_location.advanceColumn(2);
-            } else if (ch1 && ch1 == '0') {
-                isOctalish = true;
-            }
-        }
-
-        std::vector<char> numeric = readNumeric(isOctalish, isHexish);
-        if (position() != m_length && at() == '.') {
-            isFloat = true;
-            numeric.push_back('.');
-            m_location.advanceColumn();
-            std::vector<char> others = readNumeric(isOctalish, isHexish);
-            numeric.reserve(numeric.size() + others.size());
-            numeric.insert(numeric.end(), others.begin(), others.end());
-        }
-
-        if (position() != m_length && (at() == 'e' || at() == 'E')) {
-            ch1 = at(1);
-            ch2 = at(2);
-            if ((ch1 == '+' || ch1 == '-') && (ch2 >= '0' && ch2 <= '9')) {
-                numeric.push_back(ch1);
-                numeric.push_back(ch2);
-                m_location.advanceColumn(2);
-                std::vector<char> others = readNumeric(isOctalish, isHexish);
-                numeric.reserve(numeric.size() + others.size());
-                numeric.insert(numeric.end(), others.begin(), others.end());
-                isFloat = true;
-            } else {
-                m_error = "invalid numeric literal";
-                return;
-            }
-        }
-
-        if (position() != m_length && isChar(at())) {
-            ch1 = at(1);
-            if (at() == 'f' || at() == 'F') {
-                isFloat = true;
-            } else if ((at() == 'l' && ch1 == 'f') || (at() == 'L' && ch1 == 'F')) {
-                isFloat = false;
-                isDouble = true;
-                m_location.advanceColumn();
-            } else if (at() == 'u' || at() == 'U') {
-                if (isFloat) {
-                    m_error = "invalid use of suffix on literal";
-                    return;
-                }
-                isUnsigned = true;
-            } else {
-                m_error = "invalid numeric literal";
-                return;
-            }
+        readNumeric(out);
+    } else if (isIdentifier(at())) {
+        // Identifiers
+        const size_t begin = position();
+        unsigned hash = kHashBasis;
+        while (isIdentifier(at())) {
+            hash = hashAppend(hash, at());
             m_location.advanceColumn();
         }
+        const size_t length = position() - begin;
 
-        if (isHexish && (isFloat || isDouble)) {
-            m_error = "invalid numeric literal";
+        // Or is it a keyword?
+        const int keyword = findKeyword(m_data + begin, length, hash);
+        if (keyword != -1) {
+            out.m_type = kType_keyword;
+            out.asKeyword = keyword;
             return;
         }
 
-        numeric.push_back('\0');
-        int base = isHexish ? 16 : (isOctalish ? 8 : 10);
-        char *error;
-        if (isFloat) {
-            out.m_type = kType_constant_float;
-            out.asFloat = strtof(&numeric[0], &error);
-            if (error == &numeric[0]) {
-                m_error = "invalid numeric literal";
-                return;
-            }
-        } else if (isDouble) {
-            out.m_type = kType_constant_double;
-            out.asDouble = strtod(&numeric[0], &error);
-            if (error == &numeric[0]) {
-                m_error = "invalid numeric literal";
-                return;
-            }
-        } else if (isUnsigned) {
-            out.m_type = kType_constant_uint;
-            unsigned long long value = strtoull(&numeric[0], 0, base);
-            if (value <= UINT_MAX) {
-                out.asUnsigned = (unsigned int)value;
-            } else {
-                m_error = "literal needs more than 32-bits";
-            }
-        } else {
-            out.m_type = kType_constant_int;
-            long long value = strtoll(&numeric[0], 0, base);
-            if (value <= INT_MAX) {
-                out.asInt = (int)value;
-            } else {
-                m_error = "literal needs more than 32-bits";
-            }
-        }
-    } else if (isChar(at()) || at() == '_') {
-        // Identifiers
         out.m_type = kType_identifier;
-        std::vector<char> identifier;
-        while (position() != m_length && (isChar(at()) || isDigit(at()) || at() == '_')) {
-            identifier.push_back(at());
-            m_location.advanceColumn();
+        if (m_zeroCopy) {
+            out.asIdentifier = 0;
+            return;
         }
-        identifier.push_back('\0');
-        out.asIdentifier = (char *)malloc(identifier.size());
+        out.asIdentifier = (char *)malloc(length + 1);
         if (!out.asIdentifier) {
             m_error = "Out of memory";
             return;
         }
-        memcpy(out.asIdentifier, &identifier[0], identifier.size());
-
-        // Or is it a keyword?
-        for (size_t i = 0; i < sizeof(kKeywords)/sizeof(kKeywords[0]); i++) {
-            if (strcmp(kKeywords[i].name, out.asIdentifier))
-                continue;
-            free(out.asIdentifier);
-            out.asIdentifier = 0;
-            out.m_type = kType_keyword;
-            out.asKeyword = int(i);
-            break;
-        }
+        memcpy(out.asIdentifier, m_data + begin, length);
+        out.asIdentifier[length] = '\0';
     } else {
         switch (at()) {
         // Non operators
@@ -289,13 +492,7 @@ void lexer::read(token &out) {
         case '\v':
         case '\r':
         case ' ':
-            while (position() < m_length && isSpace(at())) {
-                if (at() == '\n') {
-                    m_location.advanceLine();
-					debug::inst().advanceLine();
-				} else
-                    m_location.advanceColumn();
-            }
+            skipWhitespace();
             out.m_type = kType_whitespace; // Whitespace already skippped
             break;
         case ';':
@@ -315,204 +512,368 @@ void lexer::read(token &out) {
             m_location.advanceColumn();
             break;
 
-        // Operators
-        case '.':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_dot;
-            break;
-        case '+':
-            out.m_type = kType_operator;
-            if (ch1 == '+')
-                out.asOperator = kOperator_increment;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_add_assign;
-            else
-                out.asOperator = kOperator_plus;
-            break;
-        case '-':
-            out.m_type = kType_operator;
-            if (ch1 == '-')
-                out.asOperator = kOperator_decrement;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_sub_assign;
-            else
-                out.asOperator = kOperator_minus;
-            break;
+        // Comments or operators
         case '/':
-            if (ch1 == '/') {
-                // Skip line comments
-                while (position() != m_length) {
-                    if (at() == '\n') {
-                        m_location.advanceLine();
-						debug::inst().setLine(m_location.line);
-                        break;
-                    }
-                    m_location.advanceColumn();
-                }
+            if (at(1) == '/') {
+                skipLineComment();
                 out.m_type = kType_comment;
-            } else if (ch1 == '*') {
-                // Skip block comments
-                while (position() != m_length) {
-                    if (at() == '\n') {
-                        m_location.advanceLine();
-						debug::inst().setLine(m_location.line);
-                        continue;
-                    }
-                    if (at() == '*' && position() + 1 < m_length && m_data[position() + 1] == '/') {
-                        m_location.advanceColumn(2);
-                        break;
-                    }
-                    m_location.advanceColumn();
-                }
+                break;
+            } else if (at(1) == '*') {
+                skipBlockComment();
                 out.m_type = kType_comment;
-            } else if (ch1 == '=') {
-                out.m_type = kType_operator;
-                out.asOperator = kOperator_divide_assign;
-            } else {
-                out.m_type = kType_operator;
-                out.asOperator = kOperator_divide;
+                break;
             }
+            readOperator(out);
             break;
-        case '*':
-            out.m_type = kType_operator;
-            if (ch1 == '=')
-                out.asOperator = kOperator_multiply_assign;
-            else
-                out.asOperator = kOperator_multiply;
-            break;
-        case '%':
-            out.m_type = kType_operator;
-            if (ch1 == '=')
-                out.asOperator = kOperator_modulus_assign;
-            else
-                out.asOperator = kOperator_modulus;
-            break;
-        case '<':
-            out.m_type = kType_operator;
-            if (ch1 == '<' && ch2 == '=')
-                out.asOperator = kOperator_shift_left_assign;
-            else if (ch1 == '<')
-                out.asOperator = kOperator_shift_left;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_less_equal;
-            else
-                out.asOperator = kOperator_less;
-            break;
-        case '>':
-            out.m_type = kType_operator;
-            if (ch1 == '>' && ch2 == '=')
-                out.asOperator = kOperator_shift_right_assign;
-            else if (ch1 == '>')
-                out.asOperator = kOperator_shift_right;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_greater_equal;
-            else
-                out.asOperator = kOperator_greater;
-            break;
-        case '[':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_bracket_begin;
-            break;
-        case ']':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_bracket_end;
-            break;
-        case '(':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_paranthesis_begin;
-            break;
-        case ')':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_paranthesis_end;
-            break;
-        case '^':
-            out.m_type = kType_operator;
-            if (ch1 == '^')
-                out.asOperator = kOperator_logical_xor;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_bit_xor_assign;
-            else
-                out.asOperator = kOperator_bit_xor;
-            break;
-        case '|':
-            out.m_type = kType_operator;
-            if (ch1 == '|')
-                out.asOperator = kOperator_logical_or;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_bit_or_assign;
-            else
-                out.asOperator = kOperator_bit_or;
-            break;
-        case '&':
-            out.m_type = kType_operator;
-            if (ch1 == '&')
-                out.asOperator = kOperator_logical_and;
-            else if (ch1 == '=')
-                out.asOperator = kOperator_bit_and_assign;
-            else
-                out.asOperator = kOperator_bit_and;
-            break;
-        case '~':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_bit_not;
-            break;
-        case '=':
-            out.m_type = kType_operator;
-            if (ch1 == '=')
-                out.asOperator = kOperator_equal;
-            else
-                out.asOperator = kOperator_assign;
+        default:
+            readOperator(out);
             break;
-        case '!':
-            out.m_type = kType_operator;
-            if (ch1 == '=')
-                out.asOperator = kOperator_not_equal;
-            else
-                out.asOperator = kOperator_logical_not;
+        }
+    }
+}
+
+void lexer::readOperator(token &out) {
+    // Longest match, remembering the last accepting state on the way
+    size_t state = 0;
+    size_t length = 0;
+    size_t matched = 0;
+    int match = -1;
+    while ((state = kOperatorMachine.next[state][kOperatorMachine.columns[at(length)]])) {
+        length++;
+        if (kOperatorMachine.accepts[state] != -1) {
+            match = kOperatorMachine.accepts[state];
+            matched = length;
+        }
+    }
+    if (match == -1) {
+        m_error = "invalid character encountered";
+        return;
+    }
+    out.m_type = kType_operator;
+    out.asOperator = match;
+    m_location.advanceColumn(matched);
+}
+
+void lexer::skipWhitespace() {
+    size_t end = position();
+    size_t newlines = 0;
+    size_t lastNewline = 0;
+#if defined(GLSL_LEXER_SIMD)
+    while (end + kChunkSize <= m_length) {
+        const unsigned other = ~maskSpace(m_data + end) & kChunkMask;
+        unsigned lines = maskEqual(m_data + end, '\n');
+        if (other)
+            lines &= (1u << lowestBit(other)) - 1;
+        if (lines) {
+            newlines += countBits(lines);
+            lastNewline = end + highestBit(lines);
+        }
+        if (other) {
+            end += lowestBit(other);
             break;
-        case ':':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_colon;
+        }
+        end += kChunkSize;
+    }
+#endif
+    for (; end < m_length && isSpace(m_data[end]); end++) {
+        if (m_data[end] == '\n') {
+            newlines++;
+            lastNewline = end;
+        }
+    }
+    m_location.advanceTo(end, newlines, lastNewline);
+}
+
+void lexer::skipLineComment() {
+    size_t end = position() + 2; // skip '//'
+#if defined(GLSL_LEXER_SIMD)
+    while (end + kChunkSize <= m_length) {
+        const unsigned lines = maskEqual(m_data + end, '\n');
+        if (lines) {
+            end += lowestBit(lines);
             break;
-        case ',':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_comma;
+        }
+        end += kChunkSize;
+    }
+#endif
+    while (end < m_length && m_data[end] != '\n')
+        end++;
+    // The terminating newline belongs to the comment
+    if (end < m_length)
+        m_location.advanceTo(end + 1, 1, end);
+    else
+        m_location.advanceTo(end, 0, 0);
+}
+
+void lexer::skipBlockComment() {
+    size_t end = position() + 2; // skip '/*'
+    size_t newlines = 0;
+    size_t lastNewline = 0;
+#if defined(GLSL_LEXER_SIMD)
+    while (end + kChunkSize + 1 <= m_length) {
+        const unsigned closes = maskEqual(m_data + end, '*') & maskEqual(m_data + end + 1, '/');
+        unsigned lines = maskEqual(m_data + end, '\n');
+        if (closes)
+            lines &= (1u << lowestBit(closes)) - 1;
+        if (lines) {
+            newlines += countBits(lines);
+            lastNewline = end + highestBit(lines);
+        }
+        if (closes) {
+            end += lowestBit(closes);
             break;
-        case '?':
-            out.m_type = kType_operator;
-            out.asOperator = kOperator_questionmark;
+        }
+        end += kChunkSize;
+    }
+#endif
+    for (; end < m_length; end++) {
+        if (m_data[end] == '\n') {
+            newlines++;
+            lastNewline = end;
+        } else if (m_data[end] == '*' && end + 1 < m_length && m_data[end + 1] == '/') {
             break;
-        default:
-            m_error = "invalid character encountered";
-            return;
         }
-        // Skip whitespace for operator
-        if (out.m_type == kType_operator)
-            m_location.advanceColumn(strlen(kOperators[out.asOperator].string));
     }
+    if (end < m_length)
+        end += 2; // skip '*/'
+    m_location.advanceTo(end, newlines, lastNewline);
 }
 
-std::vector<char> lexer::readNumeric(bool isOctalish, bool isHexish) {
-    std::vector<char> digits;
-    if (isOctalish) {
-        while (position() < m_length && isOctal(at())) {
-            digits.push_back(at());
-            m_location.advanceColumn();
+/// readNumeric
+// Exactly representable powers of ten
+static const double kPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Significant decimal digits kept in a 64-bit mantissa
+enum { kMantissaDigits = 19 };
+
+// Enough significant digits to round any decimal literal to a double correctly
+enum { kMaxSpelledDigits = 768 };
+
+static inline int hexValue(int ch) {
+    return isDigit(ch) ? ch - '0' : (ch | 32) - 'a' + 10;
+}
+
+// Converts mantissa * 10^exponent with a single correctly rounded operation
+// when both sides are exact doubles
+static inline bool fastDecimal(unsigned long long mantissa, int exponent, double &out) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+    return false; // Excess precision would round twice
+#endif
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+        return false;
+    if (exponent < 0)
+        out = double(mantissa) / kPowersOfTen[-exponent];
+    else
+        out = double(mantissa) * kPowersOfTen[exponent];
+    return true;
+}
+
+// A double which lies exactly halfway between two floats cannot be narrowed
+// without knowing which side of it the literal was
+static inline bool isFloatHalfway(double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof bits);
+    return (bits & 0x1FFFFFFFull) == 0x10000000ull;
+}
+
+// Respells the digits of a literal as "<digits>e<exponent>" on the stack and
+// converts that with strtod/strtof. Without a radix character the input no
+// longer depends on the current locale.
+static double slowDecimal(const char *data, size_t length, int exponent, bool single) {
+    char buffer[kMaxSpelledDigits + 16];
+    size_t count = 0;
+    bool fraction = false;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == '.') {
+            fraction = true;
+            continue;
         }
-    } else if (isHexish) {
-        while (position() < m_length && isHex(at())) {
-            digits.push_back(at());
-            m_location.advanceColumn();
+        if (count == 0 && data[i] == '0') {
+            if (fraction)
+                exponent--;
+        } else if (count < kMaxSpelledDigits) {
+            buffer[count++] = data[i];
+            if (fraction)
+                exponent--;
+        } else if (!fraction) {
+            exponent++;
+        }
+    }
+    if (count == 0)
+        buffer[count++] = '0';
+    buffer[count++] = 'e';
+    unsigned magnitude = exponent;
+    if (exponent < 0) {
+        buffer[count++] = '-';
+        magnitude = -unsigned(exponent);
+    }
+    char digits[16];
+    size_t digitCount = 0;
+    do {
+        digits[digitCount++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    while (digitCount)
+        buffer[count++] = digits[--digitCount];
+    buffer[count] = '\0';
+    return single ? strtof(buffer, 0) : strtod(buffer, 0);
+}
+
+void lexer::readNumeric(token &out) {
+    const size_t begin = position();
+    unsigned long long mantissa = 0; // The integer value or the significant decimal digits
+    int exponent = 0;                // Decimal exponent applied to the mantissa
+    bool truncated = false;          // Nonzero digits did not fit in the mantissa
+    int spelled = 0;                 // The exponent written in the literal
+    unsigned long long octal = 0;
+    bool isOctalish = false;
+    bool isOctalDigits = true;
+    bool isHexish = false;
+    bool isFloat = false;
+    bool isDouble = false;
+    bool isUnsigned = false;
+    size_t end = 0;
+
+    if (at() == '0' && (at(1) == 'x' || at(1) == 'X')) {
+        isHexish = true;
+        m_location.advanceColumn(2);
+        const size_t digits = position();
+        for (; isHex(at()); m_location.advanceColumn()) {
+            if (mantissa <= UINT_MAX) // Saturate, anything larger is an error anyway
+                mantissa = mantissa * 16 + hexValue(at());
+        }
+        if (position() == digits || at() == '.') {
+            m_error = "invalid numeric literal";
+            return;
         }
     } else {
-        while (position() < m_length && isDigit(at())) {
-            digits.push_back(at());
+        // A leading zero makes an integer octal; the digits are read both
+        // ways until a fraction or exponent says which one it is
+        isOctalish = at() == '0' && isDigit(at(1));
+        int significant = 0;
+        for (; isDigit(at()); m_location.advanceColumn()) {
+            const int digit = at() - '0';
+            if (!isOctal(at()))
+                isOctalDigits = false;
+            if (octal <= UINT_MAX)
+                octal = octal * 8 + digit;
+            if (significant < kMantissaDigits) {
+                mantissa = mantissa * 10 + digit;
+                significant += mantissa != 0;
+            } else {
+                exponent++;
+                truncated |= digit != 0;
+            }
+        }
+        if (at() == '.') {
+            isFloat = true;
+            isOctalish = false;
+            for (m_location.advanceColumn(); isDigit(at()); m_location.advanceColumn()) {
+                const int digit = at() - '0';
+                if (significant < kMantissaDigits) {
+                    mantissa = mantissa * 10 + digit;
+                    significant += mantissa != 0;
+                    exponent--;
+                } else {
+                    truncated |= digit != 0;
+                }
+            }
+        }
+        end = position();
+        if (at() == 'e' || at() == 'E') {
+            const int sign = at(1) == '-' ? -1 : 1;
+            const int skip = (at(1) == '+' || at(1) == '-') ? 2 : 1;
+            if (!isDigit(at(skip))) {
+                m_error = "invalid numeric literal";
+                return;
+            }
+            isFloat = true;
+            isOctalish = false;
+            m_location.advanceColumn(skip);
+            for (; isDigit(at()); m_location.advanceColumn()) {
+                if (spelled < 100000) // Way past the range of a double
+                    spelled = spelled * 10 + at() - '0';
+            }
+            spelled *= sign;
+            exponent += spelled;
+        }
+    }
+
+    if (isChar(at())) {
+        if (at() == 'f' || at() == 'F') {
+            isFloat = true;
+            isOctalish = false;
+        } else if ((at() == 'l' && at(1) == 'f') || (at() == 'L' && at(1) == 'F')) {
+            isFloat = false;
+            isDouble = true;
+            isOctalish = false;
             m_location.advanceColumn();
+        } else if (at() == 'u' || at() == 'U') {
+            if (isFloat) {
+                m_error = "invalid use of suffix on literal";
+                return;
+            }
+            isUnsigned = true;
+        } else {
+            m_error = "invalid numeric literal";
+            return;
+        }
+        m_location.advanceColumn();
+    }
+
+    if (isHexish && (isFloat || isDouble)) {
+        m_error = "invalid numeric literal";
+        return;
+    }
+
+    if (isFloat || isDouble) {
+        double value = 0.0;
+        const bool fast = !truncated && fastDecimal(mantissa, exponent, value);
+        if (isDouble) {
+            out.m_type = kType_constant_double;
+            out.asDouble = fast ? value : slowDecimal(m_data + begin, end - begin, spelled, false);
+        } else {
+            out.m_type = kType_constant_float;
+            if (fast && !isFloatHalfway(value))
+                out.asFloat = float(value);
+            else
+                out.asFloat = float(slowDecimal(m_data + begin, end - begin, spelled, true));
+        }
+        return;
+    }
+
+    unsigned long long value = mantissa;
+    if (isOctalish) {
+        if (!isOctalDigits) {
+            m_error = "invalid numeric literal";
+            return;
+        }
+        value = octal;
+    } else if (exponent) {
+        value = ~0ull; // Dropped digits, too large for any integer
+    }
+
+    if (isUnsigned) {
+        out.m_type = kType_constant_uint;
+        if (value <= UINT_MAX) {
+            out.asUnsigned = (unsigned int)value;
+        } else {
+            m_error = "literal needs more than 32-bits";
+        }
+    } else {
+        out.m_type = kType_constant_int;
+        if (value <= INT_MAX) {
+            out.asInt = (int)value;
+        } else {
+            m_error = "literal needs more than 32-bits";
         }
     }
-    return digits;
 }
 
+
 token lexer::read() {
     token out;
     // Return non-whitespace, non-comment token
@@ -520,20 +881,171 @@ token lexer::read() {
     return out;
 }
 
-token lexer::peek() {
-    token out;
-    backup();
-    read(out, true);
-    restore();
-    return out;
+token lexer::peek(size_t ahead) {
+    assert(ahead < kMaxLookahead);
+    while (m_lookaheadCount <= ahead) {
+        // Lex past what is already cached without moving the read position
+        const location current = m_location;
+        if (m_lookaheadCount)
+            m_location = m_lookahead[(m_lookaheadHead + m_lookaheadCount - 1) % kMaxLookahead].end;
+        lookahead &next = m_lookahead[(m_lookaheadHead + m_lookaheadCount) % kMaxLookahead];
+        next.value = token();
+        lex(next.value);
+        next.end = m_location;
+        m_location = current;
+        m_lookaheadCount++;
+    }
+    return m_lookahead[(m_lookaheadHead + ahead) % kMaxLookahead].value;
 }
 
 void lexer::read(token &out, bool) {
+    if (m_lookaheadCount) {
+        if (out.m_type == kType_identifier && !m_zeroCopy)
+            free(out.asIdentifier);
+        const lookahead &next = m_lookahead[m_lookaheadHead];
+        out = next.value;
+        m_location = next.end;
+        m_lookaheadHead = (m_lookaheadHead + 1) % kMaxLookahead;
+        m_lookaheadCount--;
+        return;
+    }
+    lex(out);
+}
+
+void lexer::lex(token &out) {
     do {
         read(out);
     } while ((out.m_type == kType_whitespace || out.m_type == kType_comment) && !m_error);
 }
 
+void lexer::tokenize(tokenStream &out, bool skipBodies) {
+    tokenize(out, skipBodies, false);
+}
+
+void lexer::tokenizeBody(tokenStream &out, size_t position, size_t line) {
+    flush();
+    size_t begin = position;
+    while (begin && m_data[begin - 1] != '\n')
+        begin--;
+    m_location.position = position;
+    m_location.line = line;
+    m_location.column = position - begin + 1;
+    tokenize(out, false, true);
+}
+
+void lexer::tokenize(tokenStream &out, bool skipBodies, bool oneBody) {
+    out.clear();
+
+    // Anything peeked is lexed again below, and an error met before is
+    // left behind with it
+    flush();
+    token value;
+    if ((m_error = checkLength(m_length))) {
+        value.m_type = kType_eof;
+        value.m_offset = position();
+        out.push(value, m_location.line);
+        out.m_error = m_error;
+        return;
+    }
+
+    // Expect a token about every eight bytes, but leave very large sources
+    // to the vectors' own growth
+    size_t expected = m_length > position() ? (m_length - position()) / 8 : 0;
+    if (expected > (size_t(1) << 20))
+        expected = size_t(1) << 20;
+    out.m_types.reserve(expected);
+    out.m_payloads.reserve(expected);
+    out.m_offsets.reserve(expected);
+    out.m_lengths.reserve(expected);
+    out.m_lines.reserve(expected);
+
+    // Stream identifiers are always slices of the source
+    const bool zeroCopy = m_zeroCopy;
+    m_zeroCopy = true;
+
+    // At the top level a `{' right after a `)' can only begin a function body
+    size_t depth = 0;
+    bool afterParanthesis = false;
+    for (;;) {
+        const size_t line = m_location.line;
+        read(value);
+        if (m_error) {
+            value.m_type = kType_eof;
+            value.m_offset = position();
+            value.m_length = 0;
+            out.push(value, m_location.line);
+            out.m_error = m_error;
+            break;
+        }
+        if (value.m_type == kType_whitespace || value.m_type == kType_comment)
+            continue;
+        out.push(value, line);
+        if (value.m_type == kType_eof)
+            break;
+        if (value.m_type == kType_scope_begin) {
+            if (skipBodies && !depth && afterParanthesis)
+                skipBody();
+            else
+                depth++;
+        } else if (value.m_type == kType_scope_end && depth && !--depth && oneBody) {
+            value.m_type = kType_eof;
+            value.m_offset = position();
+            value.m_length = 0;
+            out.push(value, m_location.line);
+            break;
+        }
+        afterParanthesis = value.m_type == kType_operator && value.asOperator == kOperator_paranthesis_end;
+    }
+
+    m_zeroCopy = zeroCopy;
+}
+
+// Move on to the `}' which ends the body just begun, only minding comments
+// so braces in them don't count
+void lexer::skipBody() {
+    size_t end = position();
+    size_t newlines = 0;
+    size_t lastNewline = 0;
+    size_t depth = 1;
+    while (end < m_length) {
+        const char ch = m_data[end];
+        if (ch == '\n') {
+            newlines++;
+            lastNewline = end;
+        } else if (ch == '{') {
+            depth++;
+        } else if (ch == '}') {
+            if (!--depth)
+                break;
+        } else if (ch == '/' && end + 1 < m_length && m_data[end + 1] == '/') {
+            while (end + 1 < m_length && m_data[end + 1] != '\n')
+                end++;
+        } else if (ch == '/' && end + 1 < m_length && m_data[end + 1] == '*') {
+            for (end += 2; end + 1 < m_length && !(m_data[end] == '*' && m_data[end + 1] == '/'); end++) {
+                if (m_data[end] == '\n') {
+                    newlines++;
+                    lastNewline = end;
+                }
+            }
+            end++;
+        }
+        end++;
+    }
+    if (end > m_length)
+        end = m_length;
+    m_location.advanceTo(end, newlines, lastNewline);
+}
+
+void lexer::flush() {
+    for (; m_lookaheadCount; m_lookaheadCount--) {
+        token &value = m_lookahead[m_lookaheadHead].value;
+        if (value.m_type == kType_identifier && !m_zeroCopy)
+            free(value.asIdentifier);
+        value = token();
+        m_lookaheadHead = (m_lookaheadHead + 1) % kMaxLookahead;
+    }
+}
+
 const char *lexer::error() const {
     return m_error;
 }
@@ -543,6 +1055,8 @@ void lexer::backup() {
 }
 
 void lexer::restore() {
+    // Anything peeked was lexed from beyond the backup position
+    flush();
     m_location = m_backup;
 }
 
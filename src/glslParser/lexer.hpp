@@ -57,11 +57,18 @@ struct token {
     float getAsFloat() const;
     double getAsDouble() const;
 
+    // Extent of the token in the source
+    size_t getOffset() const;
+    size_t getLength() const;
+
 private:
     token();
     friend struct lexer;
     friend struct parser;
+    friend struct tokenStream;
     int m_type;
+    size_t m_offset;
+    size_t m_length;
     union {
         char *asIdentifier;
         int asInt;
@@ -82,13 +89,88 @@ private:
     friend struct lexer;
     void advanceColumn(size_t count = 1);
     void advanceLine();
+    void advanceTo(size_t position, size_t newlines, size_t lastNewline);
 };
 
+// A whole source tokenized up front into parallel arrays, see lexer::tokenize.
+// Whitespace and comments are dropped and identifiers are slices of the
+// source. The last token is always kType_eof, or marks where lexing stopped
+// when error() is set.
+struct tokenStream {
+    tokenStream();
+
+    size_t size() const;
+    token operator[](size_t index) const;
+    size_t line(size_t index) const;
+    const char *error() const;
+
+    void clear();
+
+private:
+    friend struct lexer;
+    friend struct parser;
+
+    void push(const token &value, size_t line);
+
+    union payload {
+        int asInt;
+        int asKeyword;
+        int asOperator;
+        unsigned asUnsigned;
+        float asFloat;
+        double asDouble;
+    };
+
+    std::vector<unsigned char> m_types;
+    std::vector<payload> m_payloads;
+    std::vector<unsigned> m_offsets;
+    std::vector<unsigned> m_lengths;
+    std::vector<unsigned> m_lines;
+    const char *m_error;
+};
+
+inline size_t tokenStream::size() const {
+    return m_types.size();
+}
+
+inline size_t tokenStream::line(size_t index) const {
+    return m_lines[index];
+}
+
 struct lexer {
     lexer(const char *data);
+    // The source need not be NUL terminated when its length is given. Token
+    // streams keep offsets in 32 bits, so a source of 4 GiB or more is an
+    // error from the start.
+    lexer(const char *data, size_t length);
+
+    // Start over on another source, which is not padded unless said again
+    void reset(const char *data, size_t length);
+
+    // In zero-copy mode identifier tokens are not copied to the heap, they
+    // refer to their slice of the source instead, see identifier()
+    void setZeroCopy(bool enable);
+    const char *identifier(const token &identifier) const;
+
+    // Padded input is followed by at least kPadding zero bytes past its
+    // length, which lets the lexer read ahead without bounds checks
+    enum { kPadding = 16 };
+    void setPadded(bool enable);
 
     token read();
-    token peek();
+
+    // Look at an upcoming token without consuming it. Tokens which are peeked
+    // are cached so they're only ever lexed once.
+    token peek(size_t ahead = 0);
+
+    // Lex everything from the current position on in one pass. With
+    // `skipBodies' the inside of every function body is skipped and only its
+    // braces are kept, see tokenizeBody.
+    void tokenize(tokenStream &out, bool skipBodies = false);
+
+    // Lex one function body, from the `{' at `position' on `line' up to its
+    // matching `}'
+    void tokenizeBody(tokenStream &out, size_t position, size_t line);
 
     const char *error() const;
 
@@ -107,21 +189,51 @@ protected:
 
     void read(token &out);
     void read(token &out, bool);
+    void scan(token &out);
+    void skipWhitespace();
+    void skipLineComment();
+    void skipBlockComment();
+
+    void readNumeric(token &out);
+    void readOperator(token &out);
 
-    std::vector<char> readNumeric(bool isOctal, bool isHex);
+    void skipBody();
+    void tokenize(tokenStream &out, bool skipBodies, bool oneBody);
 
 private:
+    enum { kMaxLookahead = 4 };
+
+    struct lookahead {
+        token value;
+        location end;
+    };
+
+    void lex(token &out);
+    void flush();
+
     const char *m_data;
     size_t m_length;
     const char *m_error;
+    bool m_zeroCopy;
+    bool m_padded;
     location m_location;
     location m_backup;
+    lookahead m_lookahead[kMaxLookahead]; // Ring buffer of peeked tokens
+    size_t m_lookaheadHead;
+    size_t m_lookaheadCount;
 };
 
 inline size_t lexer::position() const {
     return m_location.position;
 }
 
+inline int lexer::at(int offset) const {
+    // Past the end is read as zero, which no character class accepts
+    if (m_padded || position() + offset < m_length)
+        return (unsigned char)m_data[position() + offset];
+    return 0;
+}
+
 inline size_t lexer::line() const {
     return m_location.line;
 }
@@ -1,21 +1,164 @@
-#include <string.h> // strcmp, memcpy
+#include <string.h> // strcmp, strncmp, strlen, memcpy
+#include <system_error>
+#include <thread>
 
 #include "glslParser/parser.hpp"
 #include "glslParser/util.hpp"
 
 namespace glsl {
 
+/// symbolTable
+symbolTable::symbolTable()
+    : m_slotCount(0)
+{
+}
+
+void symbolTable::push() {
+    m_scopes.push_back(m_bindings.size());
+}
+
+void symbolTable::pop() {
+    const size_t begin = m_scopes.back();
+    m_scopes.pop_back();
+    while (m_bindings.size() > begin) {
+        const binding &last = m_bindings.back();
+        m_slots[last.slot].binding = last.shadowed;
+        m_bindings.pop_back();
+    }
+}
+
+void symbolTable::add(astVariable *variable) {
+    if (!variable->name)
+        return;
+    if ((m_slotCount + 1) * 2 > m_slots.size())
+        rehash();
+    const size_t index = findSlot(variable->name);
+    slot &entry = m_slots[index];
+    if (!entry.name) {
+        entry.name = variable->name;
+        entry.binding = kNone;
+        m_slotCount++;
+    }
+    // A redeclaration in the same scope does not hide the first declaration
+    if (entry.binding != kNone && !m_scopes.empty() && entry.binding >= m_scopes.back())
+        return;
+    binding next = { variable, index, entry.binding };
+    entry.binding = m_bindings.size();
+    m_bindings.push_back(next);
+}
+
+astVariable *symbolTable::find(const char *name) const {
+    if (m_slots.empty())
+        return 0;
+    const slot &entry = m_slots[findSlot(name)];
+    if (!entry.name || entry.binding == kNone)
+        return 0;
+    return m_bindings[entry.binding].variable;
+}
+
+void symbolTable::clear() {
+    const slot empty = { 0, kNone };
+    m_slots.assign(m_slots.size(), empty);
+    m_slotCount = 0;
+    m_bindings.clear();
+    m_scopes.clear();
+}
+
+// Slot of `name' or the empty slot it would go in
+size_t symbolTable::findSlot(const char *name) const {
+    const size_t mask = m_slots.size() - 1;
+    size_t index = hashPointer(name) & mask;
+    while (m_slots[index].name && m_slots[index].name != name)
+        index = (index + 1) & mask;
+    return index;
+}
+
+void symbolTable::rehash() {
+    std::vector<slot> slots;
+    slots.swap(m_slots);
+    const slot empty = { 0, kNone };
+    m_slots.assign(slots.empty() ? 64 : slots.size() * 2, empty);
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].name)
+            m_slots[findSlot(slots[i].name)] = slots[i];
+    }
+    for (size_t i = 0; i < m_bindings.size(); i++)
+        m_bindings[i].slot = findSlot(m_bindings[i].variable->name);
+}
+
 parser::parser(const char *source, const char *fileName)
-    : m_lexer(source)
+    : parser(source, source ? strlen(source) : 0, fileName)
+{
+}
+
+parser::parser(const char *source, size_t length, const char *fileName, arena *memory, internTable *atoms)
+    : m_lexer(source, length)
+    , m_next(0)
+    , m_lineDelta(0)
+    , m_line(0)
+    , m_prelude(0)
+    , m_structureCount(0)
+    , m_scratchDepth(0)
+    , m_lazyBodies(false)
+    , m_visibleGlobals(0)
+    , m_visibleStructures(0)
+    , m_bodyThreads(1)
     , m_fileName(fileName)
+    , m_arena(memory ? memory : &m_ownArena)
+    , m_atoms(atoms ? atoms : &m_ownAtoms)
 {
+    static char outOfMemory[] = "Out of memory";
     m_ast = nullptr;
-    m_oom = strnew("Out of memory");
+    m_oom = outOfMemory;
     m_errorOccured = false;
+    m_error = 0;
+}
+
+void parser::reset(const char *source, size_t length, const char *fileName) {
+    cleanup();
+    m_lexer.reset(source, length);
+    m_fileName = fileName;
+    m_next = 0;
+    m_errorOccured = false;
+    m_error = 0;
+}
+
+void parser::setPadded(bool enable) {
+    m_lexer.setPadded(enable);
+}
+
+void parser::setLazyBodies(bool enable) {
+    m_lazyBodies = enable;
+}
+
+void parser::setBodyThreads(size_t threads) {
+    m_bodyThreads = threads;
 }
 
 parser::~parser() {
     cleanup();
+    for (size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i];
+    for (size_t i = 0; i < m_scratchItems.size(); i++)
+        delete m_scratchItems[i];
+}
+
+parser::scratchItems::scratchItems(parser &owner)
+    : items(owner.acquireScratchItems())
+    , m_owner(owner)
+{
+}
+
+parser::scratchItems::~scratchItems() {
+    m_owner.m_scratchDepth--;
+}
+
+std::vector<topLevel> &parser::acquireScratchItems() {
+    if (m_scratchDepth == m_scratchItems.size())
+        m_scratchItems.push_back(new std::vector<topLevel>);
+    std::vector<topLevel> &items = *m_scratchItems[m_scratchDepth++];
+    items.clear();
+    return items;
 }
 
 #define IS_TYPE(TOKEN, TYPE) \
@@ -25,7 +168,7 @@ parser::~parser() {
 #define IS_OPERATOR(TOKEN, OPERATOR) \
     (IS_TYPE((TOKEN), kType_operator) && (TOKEN).asOperator == (OPERATOR))
 
-#define GC_NEW(X) new(&m_memory)
+#define GC_NEW(X) astLine(m_line) << new(m_arena)
 
 bool parser::isType(int type) const {
     return IS_TYPE(m_token, type);
@@ -40,36 +183,18 @@ bool parser::isOperator(int oper) const {
 }
 
 bool parser::isEndCondition(endCondition condition) const {
-    return ((condition & kEndConditionSemicolon)    && isType(kType_semicolon))
-        || ((condition & kEndConditionParanthesis)  && isOperator(kOperator_paranthesis_end))
-        || ((condition & kEndConditionBracket)      && isOperator(kOperator_bracket_end))
-        || ((condition & kEndConditionColon)        && isOperator(kOperator_colon))
-        || ((condition & kEndConditionComma)        && isOperator(kOperator_comma));
+    return isEndCondition(m_token, condition);
 }
 
-// Constant expression evaluator
-bool parser::isConstant(astExpression *expression) const {
-    if (isConstantValue(expression))
-        return true;
-    else if (expression->type == astExpression::kVariableIdentifier) {
-        astVariable *reference = ((astVariableIdentifier*)expression)->variable;
-        if (reference->type != astVariable::kGlobal)
-            return false;
-        astExpression *initialValue = ((astGlobalVariable*)reference)->initialValue;
-        if (!initialValue)
-            return false;
-        return isConstant(initialValue);
-    } else if (expression->type == astExpression::kUnaryMinus)
-        return isConstant(((astUnaryExpression*)expression)->operand);
-    else if (expression->type == astExpression::kUnaryPlus)
-        return isConstant(((astUnaryExpression*)expression)->operand);
-    else if (expression->type == astExpression::kOperation) {
-        astOperationExpression *operation = (astOperationExpression*)expression;
-        return isConstant(operation->operand1) && isConstant(operation->operand2);
-    }
-    return false;
+bool parser::isEndCondition(const token &value, endCondition condition) const {
+    return ((condition & kEndConditionSemicolon)    && IS_TYPE(value, kType_semicolon))
+        || ((condition & kEndConditionParanthesis)  && IS_OPERATOR(value, kOperator_paranthesis_end))
+        || ((condition & kEndConditionBracket)      && IS_OPERATOR(value, kOperator_bracket_end))
+        || ((condition & kEndConditionColon)        && IS_OPERATOR(value, kOperator_colon))
+        || ((condition & kEndConditionComma)        && IS_OPERATOR(value, kOperator_comma));
 }
 
+// Constant expression evaluator
 bool parser::isConstantValue(astExpression *expression) const {
     return expression->type == astExpression::kIntConstant ||
            expression->type == astExpression::kUIntConstant ||
@@ -96,156 +221,195 @@ bool parser::isConstantValue(astExpression *expression) const {
 #define DVAL(X) (DCONST(X)->value)
 #define BVAL(X) (BCONST(X)->value)
 
-astConstantExpression *parser::evaluate(astExpression *expression) {
-    if (!expression) return 0;
-    else if (isConstantValue(expression))
-        return expression;
-    else if (expression->type == astExpression::kVariableIdentifier)
-        return evaluate(((astGlobalVariable*)((astVariableIdentifier*)expression)->variable)->initialValue);
-    else if (expression->type == astExpression::kUnaryMinus) {
-        astExpression *operand = evaluate(((astUnaryExpression*)expression)->operand);
-        if (!operand) return 0;
-        switch (operand->type) {
-        case astExpression::kIntConstant:    return ICONST_NEW(-IVAL(operand));
-        case astExpression::kFloatConstant:  return FCONST_NEW(-FVAL(operand));
-        case astExpression::kDoubleConstant: return DCONST_NEW(-DVAL(operand));
+// Checks whether an expression is constant and folds it in the same walk.
+// `value' is the folded constant, or 0 when the expression is not constant.
+// Initializers of globals are stored folded so a reference to a constant
+// global folds to that value without any work or allocation.
+CHECK_RETURN bool parser::evaluate(astExpression *expression, astConstantExpression *&value) {
+    value = 0;
+    if (isConstantValue(expression)) {
+        value = expression;
+        return true;
+    } else if (expression->type == astExpression::kVariableIdentifier) {
+        astVariable *reference = ((astVariableIdentifier*)expression)->variable;
+        if (reference->type != astVariable::kGlobal)
+            return true;
+        astExpression *initialValue = ((astGlobalVariable*)reference)->initialValue;
+        return initialValue ? evaluate(initialValue, value) : true;
+    } else if (expression->type == astExpression::kUnaryMinus || expression->type == astExpression::kUnaryPlus) {
+        astConstantExpression *operand = 0;
+        if (!evaluate(((astUnaryExpression*)expression)->operand, operand))
+            return false;
+        if (!operand)
+            return true;
+        value = expression->type == astExpression::kUnaryMinus ? foldNegation(operand) : foldPlus(operand);
+        return value != 0;
+    } else if (expression->type == astExpression::kOperation) {
+        astConstantExpression *lhs = 0;
+        astConstantExpression *rhs = 0;
+        if (!evaluate(((astBinaryExpression*)expression)->operand1, lhs))
+            return false;
+        if (!lhs)
+            return true;
+        if (!evaluate(((astBinaryExpression*)expression)->operand2, rhs))
+            return false;
+        if (!rhs)
+            return true;
+        value = foldOperation(((astOperationExpression*)expression)->operation, lhs, rhs);
+        return value != 0;
+    }
+    return true;
+}
+
+astConstantExpression *parser::foldNegation(astConstantExpression *operand) {
+    switch (operand->type) {
+    case astExpression::kIntConstant:    return ICONST_NEW(-IVAL(operand));
+    case astExpression::kFloatConstant:  return FCONST_NEW(-FVAL(operand));
+    case astExpression::kDoubleConstant: return DCONST_NEW(-DVAL(operand));
+    default:
+        fatal("invalid operation in constant expression");
+        return 0;
+    }
+}
+
+astConstantExpression *parser::foldPlus(astConstantExpression *operand) {
+    switch (operand->type) {
+    case astExpression::kIntConstant:
+    case astExpression::kUIntConstant:
+    case astExpression::kFloatConstant:
+    case astExpression::kDoubleConstant:
+        return operand;
+    default:
+        fatal("invalid operation in constant expression");
+        return 0;
+    }
+}
+
+astConstantExpression *parser::foldOperation(int operation, astConstantExpression *lhs, astConstantExpression *rhs) {
+    switch (lhs->type) {
+    case astExpression::kIntConstant:
+        switch (operation) {
+        case kOperator_multiply:       return ICONST_NEW(IVAL(lhs) * IVAL(rhs));
+        case kOperator_divide:         return ICONST_NEW(IVAL(lhs) / IVAL(rhs));
+        case kOperator_modulus:        return ICONST_NEW(IVAL(lhs) % IVAL(rhs));
+        case kOperator_plus:           return ICONST_NEW(IVAL(lhs) + IVAL(rhs));
+        case kOperator_minus:          return ICONST_NEW(IVAL(lhs) - IVAL(rhs));
+        case kOperator_shift_left:     return ICONST_NEW(IVAL(lhs) << IVAL(rhs));
+        case kOperator_shift_right:    return ICONST_NEW(IVAL(lhs) >> IVAL(rhs));
+        case kOperator_less:           return BCONST_NEW(IVAL(lhs) < IVAL(rhs));
+        case kOperator_greater:        return BCONST_NEW(IVAL(lhs) > IVAL(rhs));
+        case kOperator_less_equal:     return BCONST_NEW(IVAL(lhs) <= IVAL(rhs));
+        case kOperator_greater_equal:  return BCONST_NEW(IVAL(lhs) >= IVAL(rhs));
+        case kOperator_equal:          return BCONST_NEW(IVAL(lhs) == IVAL(rhs));
+        case kOperator_not_equal:      return BCONST_NEW(IVAL(lhs) != IVAL(rhs));
+        case kOperator_bit_and:        return ICONST_NEW(IVAL(lhs) & IVAL(rhs));
+        case kOperator_bit_xor:        return ICONST_NEW(IVAL(lhs) ^ IVAL(rhs));
+        case kOperator_logical_and:    return BCONST_NEW(IVAL(lhs) && IVAL(rhs));
+        case kOperator_logical_xor:    return BCONST_NEW(!IVAL(lhs) != !IVAL(rhs));
+        case kOperator_logical_or:     return BCONST_NEW(IVAL(lhs) || IVAL(rhs));
         default:
             fatal("invalid operation in constant expression");
             return 0;
         }
-    } else if (expression->type == astExpression::kUnaryPlus) {
-        astExpression *operand = evaluate(((astUnaryExpression*)expression)->operand);
-        if (!operand) return 0;
-        switch (operand->type) {
-        case astExpression::kIntConstant:
-        case astExpression::kUIntConstant:
-        case astExpression::kFloatConstant:
-        case astExpression::kDoubleConstant:
-            return operand;
+        break;
+    case astExpression::kUIntConstant:
+        switch (operation) {
+        case kOperator_multiply:       return UCONST_NEW(UVAL(lhs) * UVAL(rhs));
+        case kOperator_divide:         return UCONST_NEW(UVAL(lhs) / UVAL(rhs));
+        case kOperator_modulus:        return UCONST_NEW(UVAL(lhs) % UVAL(rhs));
+        case kOperator_plus:           return UCONST_NEW(UVAL(lhs) + UVAL(rhs));
+        case kOperator_minus:          return UCONST_NEW(UVAL(lhs) - UVAL(rhs));
+        case kOperator_shift_left:     return UCONST_NEW(UVAL(lhs) << UVAL(rhs));
+        case kOperator_shift_right:    return UCONST_NEW(UVAL(lhs) >> UVAL(rhs));
+        case kOperator_less:           return BCONST_NEW(UVAL(lhs) < UVAL(rhs));
+        case kOperator_greater:        return BCONST_NEW(UVAL(lhs) > UVAL(rhs));
+        case kOperator_less_equal:     return BCONST_NEW(UVAL(lhs) <= UVAL(rhs));
+        case kOperator_greater_equal:  return BCONST_NEW(UVAL(lhs) >= UVAL(rhs));
+        case kOperator_equal:          return BCONST_NEW(UVAL(lhs) == UVAL(rhs));
+        case kOperator_not_equal:      return BCONST_NEW(UVAL(lhs) != UVAL(rhs));
+        case kOperator_bit_and:        return UCONST_NEW(UVAL(lhs) & UVAL(rhs));
+        case kOperator_bit_xor:        return UCONST_NEW(UVAL(lhs) ^ UVAL(rhs));
+        case kOperator_logical_and:    return BCONST_NEW(UVAL(lhs) && UVAL(rhs));
+        case kOperator_logical_xor:    return BCONST_NEW(!UVAL(lhs) != !UVAL(rhs));
+        case kOperator_logical_or:     return BCONST_NEW(UVAL(lhs) || UVAL(rhs));
         default:
             fatal("invalid operation in constant expression");
             return 0;
         }
-    } else if (expression->type == astExpression::kOperation) {
-        int operation = ((astOperationExpression*)expression)->operation;
-        astExpression *lhs = evaluate(((astBinaryExpression*)expression)->operand1);
-        astExpression *rhs = evaluate(((astBinaryExpression*)expression)->operand2);
-        if (!lhs) return 0;
-        if (!rhs) return 0;
-        switch (lhs->type) {
-        case astExpression::kIntConstant:
-            switch (operation) {
-            case kOperator_multiply:       return ICONST_NEW(IVAL(lhs) * IVAL(rhs));
-            case kOperator_divide:         return ICONST_NEW(IVAL(lhs) / IVAL(rhs));
-            case kOperator_modulus:        return ICONST_NEW(IVAL(lhs) % IVAL(rhs));
-            case kOperator_plus:           return ICONST_NEW(IVAL(lhs) + IVAL(rhs));
-            case kOperator_minus:          return ICONST_NEW(IVAL(lhs) - IVAL(rhs));
-            case kOperator_shift_left:     return ICONST_NEW(IVAL(lhs) << IVAL(rhs));
-            case kOperator_shift_right:    return ICONST_NEW(IVAL(lhs) >> IVAL(rhs));
-            case kOperator_less:           return BCONST_NEW(IVAL(lhs) < IVAL(rhs));
-            case kOperator_greater:        return BCONST_NEW(IVAL(lhs) > IVAL(rhs));
-            case kOperator_less_equal:     return BCONST_NEW(IVAL(lhs) <= IVAL(rhs));
-            case kOperator_greater_equal:  return BCONST_NEW(IVAL(lhs) >= IVAL(rhs));
-            case kOperator_equal:          return BCONST_NEW(IVAL(lhs) == IVAL(rhs));
-            case kOperator_not_equal:      return BCONST_NEW(IVAL(lhs) != IVAL(rhs));
-            case kOperator_bit_and:        return ICONST_NEW(IVAL(lhs) & IVAL(rhs));
-            case kOperator_bit_xor:        return ICONST_NEW(IVAL(lhs) ^ IVAL(rhs));
-            case kOperator_logical_and:    return BCONST_NEW(IVAL(lhs) && IVAL(rhs));
-            case kOperator_logical_xor:    return BCONST_NEW(!IVAL(lhs) != !IVAL(rhs));
-            case kOperator_logical_or:     return BCONST_NEW(IVAL(lhs) || IVAL(rhs));
-            default:
-                fatal("invalid operation in constant expression");
-                return 0;
-            }
-            break;
-        case astExpression::kUIntConstant:
-            switch (operation) {
-            case kOperator_multiply:       return UCONST_NEW(UVAL(lhs) * UVAL(rhs));
-            case kOperator_divide:         return UCONST_NEW(UVAL(lhs) / UVAL(rhs));
-            case kOperator_modulus:        return UCONST_NEW(UVAL(lhs) % UVAL(rhs));
-            case kOperator_plus:           return UCONST_NEW(UVAL(lhs) + UVAL(rhs));
-            case kOperator_minus:          return UCONST_NEW(UVAL(lhs) - UVAL(rhs));
-            case kOperator_shift_left:     return UCONST_NEW(UVAL(lhs) << UVAL(rhs));
-            case kOperator_shift_right:    return UCONST_NEW(UVAL(lhs) >> UVAL(rhs));
-            case kOperator_less:           return BCONST_NEW(UVAL(lhs) < UVAL(rhs));
-            case kOperator_greater:        return BCONST_NEW(UVAL(lhs) > UVAL(rhs));
-            case kOperator_less_equal:     return BCONST_NEW(UVAL(lhs) <= UVAL(rhs));
-            case kOperator_greater_equal:  return BCONST_NEW(UVAL(lhs) >= UVAL(rhs));
-            case kOperator_equal:          return BCONST_NEW(UVAL(lhs) == UVAL(rhs));
-            case kOperator_not_equal:      return BCONST_NEW(UVAL(lhs) != UVAL(rhs));
-            case kOperator_bit_and:        return UCONST_NEW(UVAL(lhs) & UVAL(rhs));
-            case kOperator_bit_xor:        return UCONST_NEW(UVAL(lhs) ^ UVAL(rhs));
-            case kOperator_logical_and:    return BCONST_NEW(UVAL(lhs) && UVAL(rhs));
-            case kOperator_logical_xor:    return BCONST_NEW(!UVAL(lhs) != !UVAL(rhs));
-            case kOperator_logical_or:     return BCONST_NEW(UVAL(lhs) || UVAL(rhs));
-            default:
-                fatal("invalid operation in constant expression");
-                return 0;
-            }
-            break;
-        case astExpression::kFloatConstant:
-            switch (operation) {
-            case kOperator_multiply:       return FCONST_NEW(FVAL(lhs) * FVAL(rhs));
-            case kOperator_divide:         return FCONST_NEW(FVAL(lhs) / FVAL(rhs));
-            case kOperator_plus:           return FCONST_NEW(FVAL(lhs) + FVAL(rhs));
-            case kOperator_minus:          return FCONST_NEW(FVAL(lhs) - FVAL(rhs));
-            case kOperator_less:           return BCONST_NEW(FVAL(lhs) < FVAL(rhs));
-            case kOperator_greater:        return BCONST_NEW(FVAL(lhs) > FVAL(rhs));
-            case kOperator_less_equal:     return BCONST_NEW(FVAL(lhs) <= FVAL(rhs));
-            case kOperator_greater_equal:  return BCONST_NEW(FVAL(lhs) >= FVAL(rhs));
-            case kOperator_equal:          return BCONST_NEW(FVAL(lhs) == FVAL(rhs));
-            case kOperator_not_equal:      return BCONST_NEW(FVAL(lhs) != FVAL(rhs));
-            case kOperator_logical_and:    return BCONST_NEW(FVAL(lhs) && FVAL(rhs));
-            case kOperator_logical_xor:    return BCONST_NEW(!FVAL(lhs) != !FVAL(rhs));
-            case kOperator_logical_or:     return BCONST_NEW(FVAL(lhs) || FVAL(rhs));
-            default:
-                fatal("invalid operation in constant expression");
-                return 0;
-            }
-            break;
-        case astExpression::kDoubleConstant:
-            switch (operation) {
-            case kOperator_multiply:       return DCONST_NEW(DVAL(lhs) * DVAL(rhs));
-            case kOperator_divide:         return DCONST_NEW(DVAL(lhs) / DVAL(rhs));
-            case kOperator_plus:           return DCONST_NEW(DVAL(lhs) + DVAL(rhs));
-            case kOperator_minus:          return DCONST_NEW(DVAL(lhs) - DVAL(rhs));
-            case kOperator_less:           return BCONST_NEW(DVAL(lhs) < DVAL(rhs));
-            case kOperator_greater:        return BCONST_NEW(DVAL(lhs) > DVAL(rhs));
-            case kOperator_less_equal:     return BCONST_NEW(DVAL(lhs) <= DVAL(rhs));
-            case kOperator_greater_equal:  return BCONST_NEW(DVAL(lhs) >= DVAL(rhs));
-            case kOperator_equal:          return BCONST_NEW(DVAL(lhs) == DVAL(rhs));
-            case kOperator_not_equal:      return BCONST_NEW(DVAL(lhs) != DVAL(rhs));
-            case kOperator_logical_and:    return BCONST_NEW(DVAL(lhs) && DVAL(rhs));
-            case kOperator_logical_xor:    return BCONST_NEW(!DVAL(lhs) != !DVAL(rhs));
-            case kOperator_logical_or:     return BCONST_NEW(DVAL(lhs) || DVAL(rhs));
-            default:
-                fatal("invalid operation in constant expression");
-                return 0;
-            }
-            break;
-        case astExpression::kBoolConstant:
-            switch (operation) {
-            case kOperator_equal:          return BCONST_NEW(BVAL(lhs) == BVAL(rhs));
-            case kOperator_not_equal:      return BCONST_NEW(BVAL(lhs) != BVAL(rhs));
-            case kOperator_logical_and:    return BCONST_NEW(BVAL(lhs) && BVAL(rhs));
-            case kOperator_logical_xor:    return BCONST_NEW(!BVAL(lhs) != !BVAL(rhs));
-            case kOperator_logical_or:     return BCONST_NEW(BVAL(lhs) || BVAL(rhs));
-            default:
-                fatal("invalid operation in constant expression");
-                return 0;
-            }
-            break;
+        break;
+    case astExpression::kFloatConstant:
+        switch (operation) {
+        case kOperator_multiply:       return FCONST_NEW(FVAL(lhs) * FVAL(rhs));
+        case kOperator_divide:         return FCONST_NEW(FVAL(lhs) / FVAL(rhs));
+        case kOperator_plus:           return FCONST_NEW(FVAL(lhs) + FVAL(rhs));
+        case kOperator_minus:          return FCONST_NEW(FVAL(lhs) - FVAL(rhs));
+        case kOperator_less:           return BCONST_NEW(FVAL(lhs) < FVAL(rhs));
+        case kOperator_greater:        return BCONST_NEW(FVAL(lhs) > FVAL(rhs));
+        case kOperator_less_equal:     return BCONST_NEW(FVAL(lhs) <= FVAL(rhs));
+        case kOperator_greater_equal:  return BCONST_NEW(FVAL(lhs) >= FVAL(rhs));
+        case kOperator_equal:          return BCONST_NEW(FVAL(lhs) == FVAL(rhs));
+        case kOperator_not_equal:      return BCONST_NEW(FVAL(lhs) != FVAL(rhs));
+        case kOperator_logical_and:    return BCONST_NEW(FVAL(lhs) && FVAL(rhs));
+        case kOperator_logical_xor:    return BCONST_NEW(!FVAL(lhs) != !FVAL(rhs));
+        case kOperator_logical_or:     return BCONST_NEW(FVAL(lhs) || FVAL(rhs));
+        default:
+            fatal("invalid operation in constant expression");
+            return 0;
         }
-    } else {
-        return evaluate(expression);
+        break;
+    case astExpression::kDoubleConstant:
+        switch (operation) {
+        case kOperator_multiply:       return DCONST_NEW(DVAL(lhs) * DVAL(rhs));
+        case kOperator_divide:         return DCONST_NEW(DVAL(lhs) / DVAL(rhs));
+        case kOperator_plus:           return DCONST_NEW(DVAL(lhs) + DVAL(rhs));
+        case kOperator_minus:          return DCONST_NEW(DVAL(lhs) - DVAL(rhs));
+        case kOperator_less:           return BCONST_NEW(DVAL(lhs) < DVAL(rhs));
+        case kOperator_greater:        return BCONST_NEW(DVAL(lhs) > DVAL(rhs));
+        case kOperator_less_equal:     return BCONST_NEW(DVAL(lhs) <= DVAL(rhs));
+        case kOperator_greater_equal:  return BCONST_NEW(DVAL(lhs) >= DVAL(rhs));
+        case kOperator_equal:          return BCONST_NEW(DVAL(lhs) == DVAL(rhs));
+        case kOperator_not_equal:      return BCONST_NEW(DVAL(lhs) != DVAL(rhs));
+        case kOperator_logical_and:    return BCONST_NEW(DVAL(lhs) && DVAL(rhs));
+        case kOperator_logical_xor:    return BCONST_NEW(!DVAL(lhs) != !DVAL(rhs));
+        case kOperator_logical_or:     return BCONST_NEW(DVAL(lhs) || DVAL(rhs));
+        default:
+            fatal("invalid operation in constant expression");
+            return 0;
+        }
+        break;
+    case astExpression::kBoolConstant:
+        switch (operation) {
+        case kOperator_equal:          return BCONST_NEW(BVAL(lhs) == BVAL(rhs));
+        case kOperator_not_equal:      return BCONST_NEW(BVAL(lhs) != BVAL(rhs));
+        case kOperator_logical_and:    return BCONST_NEW(BVAL(lhs) && BVAL(rhs));
+        case kOperator_logical_xor:    return BCONST_NEW(!BVAL(lhs) != !BVAL(rhs));
+        case kOperator_logical_or:     return BCONST_NEW(BVAL(lhs) || BVAL(rhs));
+        default:
+            fatal("invalid operation in constant expression");
+            return 0;
+        }
+        break;
     }
+    fatal("invalid operation in constant expression");
     return 0;
 }
 
 void parser::fatal(const char *fmt, ...) {
     // Format banner
     char *banner = 0;
-    int bannerLength = allocfmt(&banner, "%s:%zu:%zu: error: ", m_fileName, m_lexer.line(), m_lexer.column());
+    // The location is the end of the current token
+    size_t line = 1;
+    size_t column = 1;
+    if (m_next) {
+        const size_t index = m_next - 1;
+        const size_t end = m_tokens.m_offsets[index] + m_tokens.m_lengths[index];
+        size_t begin = end;
+        while (begin && m_lexer.m_data[begin - 1] != '\n')
+            begin--;
+        line = m_tokens.line(index);
+        column = end - begin + 1;
+    }
+    int bannerLength = allocfmt(&banner, "%s:%zu:%zu: error: ", m_fileName, line, column);
     if (bannerLength == -1) {
         m_error = m_oom;
         return;
@@ -285,9 +449,13 @@ void parser::fatal(const char *fmt, ...) {
 #undef TYPENAME
 #define TYPENAME(X) case kKeyword_##X:
 bool parser::isBuiltin() const {
-    if (!isType(kType_keyword))
+    return isBuiltin(m_token);
+}
+
+bool parser::isBuiltin(const token &value) const {
+    if (!IS_TYPE(value, kType_keyword))
         return false;
-    switch (m_token.asKeyword) {
+    switch (value.asKeyword) {
     #include "glslParser/lexemes.hpp"
         return true;
     default:
@@ -300,17 +468,20 @@ bool parser::isBuiltin() const {
 
 void parser::cleanup()
 {
-    if (m_ast != nullptr)
-        delete m_ast;
+    // The AST has no destructors to run, rewinding its arena is enough
+    m_ast = nullptr;
 
     for (size_t i = 0; i < m_strings.size(); i++)
         free(m_strings[i]);
-    for (size_t i = 0; i < m_memory.size(); i++)
-        m_memory[i].destroy();
 
+    if (m_arena == &m_ownArena)
+        m_ownArena.reset();
+
+    // Tables keep their size for the next parse
     m_strings.clear();
-    m_memory.clear();
-    m_scopes.clear();
+    m_symbols.clear();
+    m_structureIndex.assign(m_structureIndex.size(), (astStruct *)0);
+    m_structureCount = 0;
 }
 
 
@@ -326,16 +497,17 @@ void parser::addGlobal(const char* name, int type, const char* typeName)
     global->initialValue = nullptr;
 
     if (type != kKeyword_struct)
-        global->baseType = GC_NEW(astType) astBuiltin(type);
+        global->baseType = astBuiltin::get(type);
     else {
         astStruct* str = GC_NEW(astType) astStruct();
-        str->name = strnew(typeName);
-        m_ast->structures.push_back(str);
+        str->name = intern(typeName, strlen(typeName));
+        if (!addStructure(str))
+            return;
 
         global->baseType = str;
     }
 
-    global->name = strnew(name);
+    global->name = intern(name, strlen(name));
     global->isInvariant = false;
     global->isPrecise = false;
     global->layoutQualifiers.clear();
@@ -345,28 +517,6 @@ void parser::addGlobal(const char* name, int type, const char* typeName)
 
     m_toAddGlobal.push_back(global);
 }
-void parser::m_addBuiltinVariables()
-{
-    // vertex inputs
-    addGlobal("gl_VertexID", kKeyword_int);
-    addGlobal("gl_InstanceID", kKeyword_int);
-    addGlobal("gl_DrawID", kKeyword_int);
-    addGlobal("gl_BaseVertex", kKeyword_int);
-    addGlobal("gl_BaseInstance", kKeyword_int);
-
-    // vertex outputs
-    addGlobal("gl_Position", kKeyword_vec4);
-    addGlobal("gl_PointSize", kKeyword_float);
-
-    // fragment inputs
-    addGlobal("gl_FragCoord", kKeyword_vec4);
-    addGlobal("gl_FrontFacing", kKeyword_bool);
-    addGlobal("gl_PointCoord", kKeyword_vec2);
-
-    // fragment outputs
-    addGlobal("gl_FragDepth", kKeyword_float);
-}
-
 // 0 -> error, 1 -> nothing parsed, 2 -> all ok
 int parser::preprocess()
 {
@@ -375,15 +525,14 @@ int parser::preprocess()
         if (!next())
             return 0;
 
-        char* idName = m_token.asIdentifier;
-
         // #line <nr>
-        if (strcmp(idName, "line") == 0) {
+        if (isType(kType_identifier) && strcmp(m_token.asIdentifier, "line") == 0) {
             if (!next())
                 return 0;
 
+            // The line after this one is <nr>
             if (isType(kType_constant_int))
-                debug::inst().setLine(m_token.asInt-1); // -1 since we will increase after the \n
+                m_lineDelta = m_token.asInt - int(m_tokens.line(m_next - 1) + 1);
         }
         
         return 2;
@@ -396,27 +545,43 @@ int parser::preprocess()
 CHECK_RETURN astTU *parser::parse(int type, bool ignoreUndefinedVariables) {
 
     m_errorOccured = false;
+    m_error = 0;
 
     if (!ignoreUndefinedVariables)
         cleanup();
     
-    m_ast = new astTU(type);
-    m_scopes.push_back(scope());
-    debug::inst().setLine(1);
+    m_ast = new(m_arena) astTU(type);
+    m_symbols.push();
+    m_lexer.tokenize(m_tokens, defersBodies());
+    m_deferredBodies.clear();
+    m_next = 0;
+    m_lineDelta = 0;
+    m_line = 0;
 
-    m_addBuiltinVariables();
+    m_prelude = &prelude::get(type);
 
     for (int i = 0; i < m_toAddGlobal.size(); i++)
-        m_scopes.back().push_back(m_toAddGlobal[i]);
+        m_symbols.add(m_toAddGlobal[i]);
 
+    // Kept for the scope of deferred bodies
+    m_addedGlobals.swap(m_toAddGlobal);
     m_toAddGlobal.clear();
 
+    // Bodies before a syntax error at the top level are still parsed when
+    // deferred, an error in one of them would have come first
+    const bool parsed = parseTranslationUnit();
+    if (!m_lazyBodies && m_bodyThreads != 1 && !parseBodies())
+        return 0;
+    return parsed ? m_ast : 0;
+}
+
+CHECK_RETURN bool parser::parseTranslationUnit() {
     for (;;) {
-        m_lexer.read(m_token, true);
+        read();
 
-        if (m_lexer.error()) {
-            fatal("%s", m_lexer.error());
-            return 0;
+        if (isLexerError()) {
+            fatal("%s", m_tokens.error());
+            return false;
         }
 
         if (isType(kType_eof))
@@ -424,15 +589,16 @@ CHECK_RETURN astTU *parser::parse(int type, bool ignoreUndefinedVariables) {
 
         int ppRes = preprocess();
         if (ppRes == 0)
-            return 0;
+            return false;
         else if (ppRes == 2) {
             if (!next())
-                return 0;
+                return false;
         }
 
-        std::vector<topLevel> items;
+        scratchItems scratch(*this);
+        std::vector<topLevel> &items = scratch.items;
         if (!parseTopLevel(items))
-            return 0;
+            return false;
         
         if (isType(kType_semicolon)) {
             for (size_t i = 0; i < items.size(); i++) {
@@ -444,35 +610,38 @@ CHECK_RETURN astTU *parser::parse(int type, bool ignoreUndefinedVariables) {
                 global->precision = parse.precision;
                 global->interpolation = parse.interpolation;
                 global->baseType = parse.type;
-                global->name = strnew(parse.name);
+                global->name = parse.name;
                 global->isInvariant = parse.isInvariant;
                 global->isPrecise = parse.isPrecise;
-                global->layoutQualifiers = parse.layoutQualifiers;
-                if (parse.initialValue) {
-                    if (!(global->initialValue = evaluate(parse.initialValue)))
-                        return 0;
-                }
+                if (!assign(global->layoutQualifiers, parse.layoutQualifiers))
+                    return false;
+                global->initialValue = parse.initialValue; // Already folded
                 global->isArray = parse.isArray;
-                global->arraySizes = parse.arraySizes;
-                m_ast->globals.push_back(global);
-                m_scopes.back().push_back(global);
+                if (!assign(global->arraySizes, parse.arraySizes))
+                    return false;
+                if (!append(m_ast->globals, global))
+                    return false;
+                m_symbols.add(global);
             }
         }
         else if (isOperator(kOperator_paranthesis_begin)) {
             astFunction *function = parseFunction(items.front());
             if (!function)
-                return 0;
-            m_ast->functions.push_back(function);
+                return false;
+            if (!append(m_ast->functions, function))
+                return false;
         }
         else if (isType(kType_whitespace)) {
             continue; // whitespace tokens will be used later for the preprocessor
         }
         else {
             fatal("syntax error at top level %d", m_token.asKeyword);
-            return 0;
+            return false;
         }
     }
-    return m_ast;
+    m_visibleGlobals = m_ast->globals.size();
+    m_visibleStructures = m_ast->structures.size();
+    return true;
 }
 
 CHECK_RETURN bool parser::parseStorage(topLevel &current) {
@@ -589,55 +758,64 @@ CHECK_RETURN bool parser::parseMemory(topLevel &current) {
     return true;
 }
 
-static struct {
-    const char *qualifier;
+// One row for every kLayout_*
+static const struct layoutQualifier {
+    const char *name;
+    int id;
     bool isAssign;
 } kLayoutQualifiers[] = {
-    { "shared",                     false },
-    { "packed",                     false },
-    { "std140",                     false },
-    { "row_major",                  false },
-    { "column_major",               false },
-    { "binding",                    true  },
-    { "offset",                     true  },
-    { "align",                      true  },
-    { "location",                   true  },
-    { "component",                  true  },
-    { "index",                      true  },
-    { "triangles",                  false },
-    { "quads",                      false },
-    { "isolines",                   false },
-    { "equal_spacing",              false },
-    { "fractional_even_spacing",    false },
-    { "fractional_odd_spacing",     false },
-    { "cw",                         false },
-    { "ccw",                        false },
-    { "point_mode",                 false },
-    { "points",                     false },
-    { "lines",                      false },
-    { "lines_adjacency",            false },
-    { "triangles_adjacency",        false },
-    { "invocations",                true  },
-    { "origin_upper_left",          false },
-    { "pixel_center_integer",       false },
-    { "early_fragment_tests",       false },
-    { "local_size_x",               true  },
-    { "local_size_y",               true  },
-    { "local_size_z",               true  },
-    { "xfb_buffer",                 true  },
-    { "xfb_stride",                 true  },
-    { "xfb_offset",                 true  },
-    { "vertices",                   true  },
-    { "line_strip",                 false },
-    { "triangle_strip",             false },
-    { "max_vertices",               true  },
-    { "stream",                     true  },
-    { "depth_any",                  false },
-    { "depth_greater",              false },
-    { "depth_less",                 false },
-    { "depth_unchanged",            false }
+    { "shared",                  kLayout_shared,                   false },
+    { "packed",                  kLayout_packed,                   false },
+    { "std140",                  kLayout_std140,                   false },
+    { "row_major",               kLayout_row_major,                false },
+    { "column_major",            kLayout_column_major,             false },
+    { "binding",                 kLayout_binding,                  true  },
+    { "offset",                  kLayout_offset,                   true  },
+    { "align",                   kLayout_align,                    true  },
+    { "location",                kLayout_location,                 true  },
+    { "component",               kLayout_component,                true  },
+    { "index",                   kLayout_index,                    true  },
+    { "triangles",               kLayout_triangles,                false },
+    { "quads",                   kLayout_quads,                    false },
+    { "isolines",                kLayout_isolines,                 false },
+    { "equal_spacing",           kLayout_equal_spacing,            false },
+    { "fractional_even_spacing", kLayout_fractional_even_spacing,  false },
+    { "fractional_odd_spacing",  kLayout_fractional_odd_spacing,   false },
+    { "cw",                      kLayout_cw,                       false },
+    { "ccw",                     kLayout_ccw,                      false },
+    { "point_mode",              kLayout_point_mode,               false },
+    { "points",                  kLayout_points,                   false },
+    { "lines",                   kLayout_lines,                    false },
+    { "lines_adjacency",         kLayout_lines_adjacency,          false },
+    { "triangles_adjacency",     kLayout_triangles_adjacency,      false },
+    { "invocations",             kLayout_invocations,              true  },
+    { "origin_upper_left",       kLayout_origin_upper_left,        false },
+    { "pixel_center_integer",    kLayout_pixel_center_integer,     false },
+    { "early_fragment_tests",    kLayout_early_fragment_tests,     false },
+    { "local_size_x",            kLayout_local_size_x,             true  },
+    { "local_size_y",            kLayout_local_size_y,             true  },
+    { "local_size_z",            kLayout_local_size_z,             true  },
+    { "xfb_buffer",              kLayout_xfb_buffer,               true  },
+    { "xfb_stride",              kLayout_xfb_stride,               true  },
+    { "xfb_offset",              kLayout_xfb_offset,               true  },
+    { "vertices",                kLayout_vertices,                 true  },
+    { "line_strip",              kLayout_line_strip,               false },
+    { "triangle_strip",          kLayout_triangle_strip,           false },
+    { "max_vertices",            kLayout_max_vertices,             true  },
+    { "stream",                  kLayout_stream,                   true  },
+    { "depth_any",               kLayout_depth_any,                false },
+    { "depth_greater",           kLayout_depth_greater,            false },
+    { "depth_less",              kLayout_depth_less,               false },
+    { "depth_unchanged",         kLayout_depth_unchanged,          false }
 };
 
+// Layout qualifier names are identifiers, they're resolved with a perfect
+// hash built once from the table above
+static int findLayoutQualifier(const char *name, size_t length) {
+    static const perfectHash kLayoutHash(kLayoutQualifiers, sizeof(kLayoutQualifiers)/sizeof(kLayoutQualifiers[0]), &layoutQualifier::name);
+    return kLayoutHash.find(name, length, hashString(name, length));
+}
+
 CHECK_RETURN bool parser::parseLayout(topLevel &current) {
     std::vector<astLayoutQualifier*> &qualifiers = current.layoutQualifiers;
     if (isKeyword(kKeyword_layout)) {
@@ -655,22 +833,18 @@ CHECK_RETURN bool parser::parseLayout(topLevel &current) {
             // "The tokens used for layout-qualifier-name are identifiers,
             //  not keywords, however, the shared keyword is allowed as a
             //  layout-qualifier-id."
-            if (!isType(kType_identifier) && !isKeyword(kKeyword_shared))
+            if (!isType(kType_identifier) && !isKeyword(kKeyword_shared)) {
+                fatal("expected layout qualifier name");
                 return false;
-
-            int found = -1;
-            qualifier->name = strnew(isType(kType_identifier) ? m_token.asIdentifier : "shared");
-            for (size_t i = 0; i < sizeof(kLayoutQualifiers)/sizeof(kLayoutQualifiers[0]); i++) {
-                if (strcmp(qualifier->name, kLayoutQualifiers[i].qualifier))
-                    continue;
-                found = int(i);
-                break;
             }
 
+            qualifier->name = isType(kType_identifier) ? m_token.asIdentifier : intern("shared", 6);
+            const int found = findLayoutQualifier(qualifier->name, isType(kType_identifier) ? m_token.m_length : 6);
             if (found == -1) {
                 fatal("unknown layout qualifier `%s'", qualifier->name);
                 return false;
             }
+            qualifier->id = kLayoutQualifiers[found].id;
 
             if (!next()) // skip identifier or 'shared' keyword
                 return false;
@@ -682,16 +856,15 @@ CHECK_RETURN bool parser::parseLayout(topLevel &current) {
                 }
                 if (!next()) // skip '='
                     return false;
-                if (!(qualifier->initialValue = parseExpression(kEndConditionComma | kEndConditionParanthesis)))
+                astExpression *expression = parseExpression(kEndConditionComma | kEndConditionParanthesis);
+                if (!expression || !evaluate(expression, qualifier->initialValue))
                     return false;
-                if (!isConstant(qualifier->initialValue)) {
+                if (!qualifier->initialValue) {
                     // TODO: check integer-constant-expression
                     fatal("value for layout qualifier `%s' is not a valid constant expression",
                         qualifier->name);
                     return false;
                 }
-                if (!(qualifier->initialValue = evaluate(qualifier->initialValue)))
-                    return false;
             } else if (kLayoutQualifiers[found].isAssign) {
                 fatal("expected layout qualifier value for `%s' layout qualifier", qualifier->name);
                 return false;
@@ -710,12 +883,15 @@ CHECK_RETURN bool parser::parseLayout(topLevel &current) {
 }
 
 CHECK_RETURN bool parser::parseTopLevelItem(topLevel &level, topLevel *continuation) {
-    std::vector<topLevel> items;
+    scratchItems scratch(*this);
+    std::vector<topLevel> &items = scratch.items;
     while (!isBuiltin() && !isType(kType_identifier)) {
         // If this is an empty file don't get caught in this loop indefinitely
-        token peek = m_lexer.peek();
-        if (IS_TYPE(peek, kType_eof))
+        token peek = this->peek();
+        if (IS_TYPE(peek, kType_eof)) {
+            fatal("premature end of file");
             return false;
+        }
 
         topLevel next;
         if (continuation)
@@ -734,7 +910,8 @@ CHECK_RETURN bool parser::parseTopLevelItem(topLevel &level, topLevel *continuat
             astStruct *unique = parseStruct();
             if (!unique)
                 return false;
-            m_ast->structures.push_back(unique);
+            if (!addStructure(unique))
+                return 0;
             if (isType(kType_semicolon))
             {
                 return true;
@@ -847,9 +1024,13 @@ CHECK_RETURN bool parser::parseTopLevelItem(topLevel &level, topLevel *continuat
             // Could be an array
             while (isOperator(kOperator_bracket_begin)) {
                 level.isArray = true;
-                astConstantExpression *arraySize = parseArraySize();
-                if (!arraySize)
+                astConstantExpression *arraySize = 0;
+                if (!parseArraySize(arraySize))
                     return false;
+                if (!arraySize) {
+                    fatal("expected array size");
+                    return false;
+                }
                 level.arraySizes.insert(level.arraySizes.begin(), arraySize);
                 level.arrayOnTypeOffset++;
                 if (!next()) // skip ']'
@@ -864,14 +1045,17 @@ CHECK_RETURN bool parser::parseTopLevelItem(topLevel &level, topLevel *continuat
     }
 
     if (isType(kType_identifier)) {
-        level.name = strnew(m_token.asIdentifier);
+        level.name = m_token.asIdentifier;
         if (!next())// skip identifier
             return false;
     }
 
     while (isOperator(kOperator_bracket_begin)) {
         level.isArray = true;
-        level.arraySizes.push_back(parseArraySize());
+        astConstantExpression *arraySize = 0;
+        if (!parseArraySize(arraySize))
+            return false;
+        level.arraySizes.push_back(arraySize);
         if (!next()) // skip ']'
             return false;
     }
@@ -880,9 +1064,10 @@ CHECK_RETURN bool parser::parseTopLevelItem(topLevel &level, topLevel *continuat
     if (isOperator(kOperator_assign)) {
         if (!next()) // skip '='
             return false;
-        if (!(level.initialValue = parseExpression(kEndConditionSemicolon)))
+        astExpression *expression = parseExpression(kEndConditionSemicolon);
+        if (!expression || !evaluate(expression, level.initialValue))
             return false;
-        if (!isConstant(level.initialValue)) {
+        if (!level.initialValue) {
             fatal("not a valid constant expression");
             return false;
         }
@@ -929,7 +1114,7 @@ CHECK_RETURN astStruct *parser::parseStruct() {
     astStruct *unique = GC_NEW(astType) astStruct;
 
     if (isType(kType_identifier)) {
-        unique->name = strnew(m_token.asIdentifier);
+        unique->name = m_token.asIdentifier;
         if (!next()) return 0; // skip identifier
     }
 
@@ -940,7 +1125,8 @@ CHECK_RETURN astStruct *parser::parseStruct() {
 
     if (!next()) return 0; // skip '{'
 
-    std::vector<topLevel> items;
+    scratchItems scratch(*this);
+    std::vector<topLevel> &items = scratch.items;
     while (!isType(kType_scope_end)) {
         if (!parseTopLevel(items))
             return 0;
@@ -952,11 +1138,17 @@ CHECK_RETURN astStruct *parser::parseStruct() {
         topLevel &parse = items[i];
         astVariable *field = GC_NEW(astVariable) astVariable(astVariable::kField);
         field->baseType = parse.type;
-        field->name = strnew(parse.name);
+        field->name = parse.name;
         field->isPrecise = parse.isPrecise;
         field->isArray = parse.isArray;
-        field->arraySizes = parse.arraySizes;
-        unique->fields.push_back(field);
+        if (!assign(field->arraySizes, parse.arraySizes))
+            return 0;
+        if (!append(unique->fields, field))
+            return 0;
+    }
+    if (!unique->indexFields(m_arena)) {
+        fatal("Out of memory");
+        return 0;
     }
 
     if (!next()) return 0; // skip '}'
@@ -964,93 +1156,41 @@ CHECK_RETURN astStruct *parser::parseStruct() {
     return unique;
 }
 
-CHECK_RETURN astExpression *parser::parseBinary(int lhsPrecedence, astExpression *lhs, endCondition end) {
-    // Precedence climbing
-    while (!isEndCondition(end)) {
-        int binaryPrecedence = m_token.precedence();
-        if (binaryPrecedence < lhsPrecedence)
-            break;
-
-        astBinaryExpression *expression = createExpression();
-        if (!next())
-            return 0;
-
-        astExpression *rhs = parseUnary(end);
-        if (!rhs)
-            return 0;
-        if (!next())
-            return 0;
-
-        if (((astExpression*)expression)->type == astExpression::kAssign) {
-            astExpression *find = lhs;
-            while (find->type == astExpression::kArraySubscript
-                || find->type == astExpression::kFieldOrSwizzle)
-            {
-                find = (find->type == astExpression::kArraySubscript)
-                    ? ((astArraySubscript*)find)->operand
-                    : ((astFieldOrSwizzle*)find)->operand;
-            }
-            if (find->type != astExpression::kVariableIdentifier) {
-                fatal("not a valid lvalue");
-                return 0;
-            }
-            astVariable *variable = ((astVariableIdentifier*)lhs)->variable;
-            if (variable->type == astVariable::kGlobal) {
-                astGlobalVariable *global = (astGlobalVariable*)variable;
-                // "It's a compile-time error to write to a variable declared as an input"
-                if (global->storage == kIn) {
-                    fatal("cannot write to a variable declared as input");
-                    return 0;
-                }
-                // "It's a compile-time error to write to a const variable outside of its declaration."
-                if (global->storage == kConst) {
-                    fatal("cannot write to a const variable outside of its declaration");
-                    return 0;
-                }
-            }
+CHECK_RETURN bool parser::checkAssignment(astExpression *lhs) {
+    astExpression *find = lhs;
+    while (find->type == astExpression::kArraySubscript
+        || find->type == astExpression::kFieldOrSwizzle)
+    {
+        find = (find->type == astExpression::kArraySubscript)
+            ? ((astArraySubscript*)find)->operand
+            : ((astFieldOrSwizzle*)find)->operand;
+    }
+    if (find->type != astExpression::kVariableIdentifier) {
+        fatal("not a valid lvalue");
+        return false;
+    }
+    astVariable *variable = ((astVariableIdentifier*)lhs)->variable;
+    if (variable->type == astVariable::kGlobal) {
+        astGlobalVariable *global = (astGlobalVariable*)variable;
+        // "It's a compile-time error to write to a variable declared as an input"
+        if (global->storage == kIn) {
+            fatal("cannot write to a variable declared as input");
+            return false;
         }
-
-        int rhsPrecedence = m_token.precedence();
-
-        // climb
-        if (binaryPrecedence < rhsPrecedence) {
-            if (!(rhs = parseBinary(binaryPrecedence + 1, rhs, end)))
-                return 0;
+        // "It's a compile-time error to write to a const variable outside of its declaration."
+        if (global->storage == kConst) {
+            fatal("cannot write to a const variable outside of its declaration");
+            return false;
         }
+    }
+    return true;
+}
 
-        expression->operand1 = lhs;
-        expression->operand2 = rhs;
-        lhs = expression;
-    }
-    return lhs;
-}
-
-CHECK_RETURN astExpression *parser::parseUnaryPrefix(endCondition condition) {
-    if (isOperator(kOperator_paranthesis_begin)) {
-        if (!next()) return 0; // skip '('
-        return parseExpression(kEndConditionParanthesis);
-    } else if (isOperator(kOperator_logical_not)) {
-        if (!next()) return 0; // skip '!'
-        return GC_NEW(astExpression) astUnaryLogicalNotExpression(parseUnary(condition));
-    } else if (isOperator(kOperator_bit_not)) {
-        if (!next()) return 0; // skip '~'
-        return GC_NEW(astExpression) astUnaryBitNotExpression(parseUnary(condition));
-    } else if (isOperator(kOperator_plus)) {
-        if (!next()) return 0; // skip '+'
-        return GC_NEW(astExpression) astUnaryPlusExpression(parseUnary(condition));
-    } else if (isOperator(kOperator_minus)) {
-        if (!next()) return 0; // skip '-'
-        return GC_NEW(astExpression) astUnaryMinusExpression(parseUnary(condition));
-    } else if (isOperator(kOperator_increment)) {
-        if (!next()) return 0; // skip '++'
-        return GC_NEW(astExpression) astPrefixIncrementExpression(parseUnary(condition));
-    } else if (isOperator(kOperator_decrement)) {
-        if (!next()) return 0; // skip '--'
-        return GC_NEW(astExpression) astPrefixDecrementExpression(parseUnary(condition));
-    } else if (isBuiltin()) {
+CHECK_RETURN astExpression *parser::parsePrimary() {
+    if (isBuiltin()) {
         return parseConstructorCall();
     } else if (isType(kType_identifier)) {
-        token peek = m_lexer.peek();
+        token peek = this->peek();
         if (IS_OPERATOR(peek, kOperator_paranthesis_begin)) {
             astType *type = findType(m_token.asIdentifier);
             if (type)
@@ -1076,8 +1216,6 @@ CHECK_RETURN astExpression *parser::parseUnaryPrefix(endCondition condition) {
         return FCONST_NEW(m_token.asFloat);
     } else if (isType(kType_constant_double)) {
         return DCONST_NEW(m_token.asDouble);
-    } else if (condition == kEndConditionBracket) {
-        return 0;
     }
     fatal("syntax error during unary prefix");
     return 0;
@@ -1106,99 +1244,223 @@ astType* parser::getType(astExpression *expression)
     return 0;
 }
 
-CHECK_RETURN astExpression *parser::parseUnary(endCondition end) {
-    astExpression *operand = parseUnaryPrefix(end);
-    if (!operand)
+CHECK_RETURN astExpression *parser::parseFieldOrSwizzle(astExpression *operand) {
+    if (!next()) return 0; // skip last
+    if (!next()) return 0; // skip '.'
+    if (!isType(kType_identifier)) {
+        fatal("expected field identifier or swizzle after `.'");
         return 0;
+    }
+    astFieldOrSwizzle *expression = GC_NEW(astExpression) astFieldOrSwizzle();
+    // check to see if the field exists
+    if (operand->type == astExpression::kVariableIdentifier) {
+        if (!((astVariableIdentifier*)operand)->variable->baseType->builtin) {
+            astStruct *type = (astStruct*)getType(operand);
+            if (type) {
+                astVariable *field = type->findField(m_token.asIdentifier);
+                if (!field) {
+                    fatal("field `%s' does not exist in structure `%s'", m_token.asIdentifier, type->name);
+                    return 0;
+                }
+            }
+        }
+    }
+    expression->operand = operand;
+    expression->name = m_token.asIdentifier;
+    return expression;
+}
+
+CHECK_RETURN astExpression *parser::parseArraySubscript(astExpression *operand) {
+    if (!next()) return 0; // skip last
+    if (!next()) return 0; // skip '['
+    astArraySubscript *expression = GC_NEW(astExpression) astArraySubscript();
+    astExpression *find = operand;
+    while (find->type == astExpression::kArraySubscript)
+        find = ((astArraySubscript*)find)->operand;
+    if (find->type != astExpression::kVariableIdentifier) {
+        fatal("cannot be subscripted");
+        return 0;
+    }
+    expression->operand = operand;
+    if (!(expression->index = parseExpression(kEndConditionBracket)))
+        return 0;
+    astConstantExpression *index = 0;
+    if (!evaluate(expression->index, index))
+        return 0;
+    if (index)
+        expression->index = index;
+    return expression;
+}
+
+// Operator precedence parsing with an explicit stack rather than recursion,
+// so long chains of operators and deeply nested parentheses cost no native
+// stack. Operators still waiting for an operand are kept on m_operators above
+// `base', binary ones already hold their left hand side. Binary operators of
+// the same precedence group to the left. Prefix operators take the whole
+// unary expression after them, postfix ones and a ternary included, and the
+// else case of a ternary is a unary expression as well.
+CHECK_RETURN astExpression *parser::parseOperators(endCondition end, size_t base) {
+    astExpression *operand = 0;
     for (;;) {
-        token peek = m_lexer.peek();
-        if (IS_OPERATOR(peek, kOperator_dot)) {
-            if (!next()) return 0; // skip last
-            if (!next()) return 0; // skip '.'
-            if (!isType(kType_identifier)) {
-                fatal("expected field identifier or swizzle after `.'");
-                return 0;
+        if (!operand) {
+            if (isOperator(kOperator_paranthesis_begin)) {
+                pendingOperator paranthesis = { pendingOperator::kParanthesis, end, 0 };
+                m_operators.push_back(paranthesis);
+                end = kEndConditionParanthesis;
+                if (!next()) return 0; // skip '('
+                continue;
             }
-            astFieldOrSwizzle *expression = GC_NEW(astExpression) astFieldOrSwizzle();
-            // check to see if the field exists
-			
-			if (operand->type == astExpression::kVariableIdentifier) {
-				if (!((astVariableIdentifier*)operand)->variable->baseType->builtin) {
-					astStruct *type = (astStruct*)getType(operand);
-					if (type) {
-						astVariable *field = 0;
-						for (size_t i = 0; i < type->fields.size(); i++) {
-							if (strcmp(type->fields[i]->name, m_token.asIdentifier))
-								continue;
-							field = type->fields[i];
-							break;
-						}
-						if (!field) {
-							fatal("field `%s' does not exist in structure `%s'", m_token.asIdentifier, type->name);
-							return 0;
-						}
-					}
-				}
-			}
-
-            expression->operand = operand;
-            expression->name = strnew(m_token.asIdentifier);
-            operand = expression;
-        } else if (IS_OPERATOR(peek, kOperator_increment)) {
-            if (!next()) return 0; // skip last
-            operand = GC_NEW(astExpression) astPostIncrementExpression(operand);
-        } else if (IS_OPERATOR(peek, kOperator_decrement)) {
-            if (!next()) return 0; // skip last
-            operand = GC_NEW(astExpression) astPostDecrementExpression(operand);
-        } else if (IS_OPERATOR(peek, kOperator_bracket_begin)) {
-            if (!next()) return 0; // skip last
-            if (!next()) return 0; // skip '['
-            astArraySubscript *expression = GC_NEW(astExpression) astArraySubscript();
-            astExpression *find = operand;
-            while (find->type == astExpression::kArraySubscript)
-                find = ((astArraySubscript*)find)->operand;
-            if (find->type != astExpression::kVariableIdentifier) {
-                fatal("cannot be subscripted");
-                return 0;
+            if (isType(kType_operator)) {
+                switch (m_token.asOperator) {
+                case kOperator_logical_not:
+                case kOperator_bit_not:
+                case kOperator_plus:
+                case kOperator_minus:
+                case kOperator_increment:
+                case kOperator_decrement: {
+                    pendingOperator prefix = { pendingOperator::kPrefix, m_token.asOperator, 0 };
+                    m_operators.push_back(prefix);
+                    if (!next()) return 0; // skip prefix operator
+                    continue;
+                }
+                }
             }
-            expression->operand = operand;
-            if (!(expression->index = parseExpression(kEndConditionBracket)))
+            if (!(operand = parsePrimary()))
                 return 0;
-            if (isConstant(expression->index)) {
-                if (!(expression->index = evaluate(expression->index)))
+        }
+
+        // Postfix operators, the ternary is parsed as one as well
+        bool ternary = false;
+        for (;;) {
+            const int peek = peekOperator();
+            if (peek == kOperator_dot) {
+                if (!(operand = parseFieldOrSwizzle(operand)))
+                    return 0;
+            } else if (peek == kOperator_increment) {
+                if (!next()) return 0; // skip last
+                operand = GC_NEW(astExpression) astPostIncrementExpression(operand);
+            } else if (peek == kOperator_decrement) {
+                if (!next()) return 0; // skip last
+                operand = GC_NEW(astExpression) astPostDecrementExpression(operand);
+            } else if (peek == kOperator_bracket_begin) {
+                if (!(operand = parseArraySubscript(operand)))
                     return 0;
+            } else {
+                ternary = peek == kOperator_questionmark;
+                break;
             }
-            operand = expression;
-        } else if (IS_OPERATOR(peek, kOperator_questionmark)) {
+        }
+
+        if (ternary) {
             if (!next()) return 0; // skip last
             if (!next()) return 0; // skip '?'
             astTernaryExpression *expression = GC_NEW(astExpression) astTernaryExpression();
             expression->condition = operand;
-            expression->onTrue = parseExpression(kEndConditionColon);
-            if (!isOperator(kOperator_colon)) {
-                fatal("expected `:' for else case in ternary statement");
-                return 0;
-            }
-            if (!next()) return 0; // skip ':'
-            if (!(expression->onFalse = parseUnary(end))) {
-                fatal("expected expression after `:' in ternary statement");
-                return 0;
+            pendingOperator pending = { pendingOperator::kTernary, end, expression };
+            m_operators.push_back(pending);
+            end = kEndConditionColon;
+            operand = 0;
+            continue;
+        }
+
+        // The unary expression is complete, it's the operand of the prefix
+        // operators before it and the else case of a ternary
+        while (m_operators.size() > base) {
+            const pendingOperator &pending = m_operators.back();
+            if (pending.kind == pendingOperator::kTernaryElse) {
+                ((astTernaryExpression*)pending.node)->onFalse = operand;
+                operand = pending.node;
+            } else if (pending.kind != pendingOperator::kPrefix) {
+                break;
+            } else if (pending.value == kOperator_logical_not) {
+                operand = GC_NEW(astExpression) astUnaryLogicalNotExpression(operand);
+            } else if (pending.value == kOperator_bit_not) {
+                operand = GC_NEW(astExpression) astUnaryBitNotExpression(operand);
+            } else if (pending.value == kOperator_plus) {
+                operand = GC_NEW(astExpression) astUnaryPlusExpression(operand);
+            } else if (pending.value == kOperator_minus) {
+                operand = GC_NEW(astExpression) astUnaryMinusExpression(operand);
+            } else if (pending.value == kOperator_increment) {
+                operand = GC_NEW(astExpression) astPrefixIncrementExpression(operand);
+            } else {
+                operand = GC_NEW(astExpression) astPrefixDecrementExpression(operand);
             }
+            m_operators.pop_back();
+        }
+
+        if (!next()) // skip last
+            return 0;
+
+        // A unary expression right after a binary operator is its right hand
+        // side, the left hand side of an assignment can be checked now
+        if (m_operators.size() > base && m_operators.back().kind == pendingOperator::kBinary
+            && m_operators.back().node->type == astExpression::kAssign
+            && !checkAssignment(((astBinaryExpression*)m_operators.back().node)->operand1))
+        {
+            return 0;
+        }
+
+        // Binary operators of the same or a higher precedence are complete
+        const int precedence = isEndCondition(end) ? -1 : m_token.precedence();
+        while (m_operators.size() > base && m_operators.back().kind == pendingOperator::kBinary
+            && m_operators.back().value >= precedence)
+        {
+            astBinaryExpression *expression = (astBinaryExpression*)m_operators.back().node;
+            m_operators.pop_back();
+            expression->operand2 = operand;
             operand = expression;
-        } else {
-            break;
         }
+
+        if (precedence >= 0) {
+            astBinaryExpression *expression = createExpression();
+            if (!expression)
+                return 0;
+            expression->operand1 = operand;
+            operand = 0;
+            pendingOperator binary = { pendingOperator::kBinary, precedence, expression };
+            m_operators.push_back(binary);
+            if (!next()) return 0; // skip operator
+            continue;
+        }
+
+        // Either the whole expression is done or the one in parentheses or
+        // the one for the then case of a ternary
+        if (m_operators.size() == base)
+            return operand;
+
+        const pendingOperator pending = m_operators.back();
+        m_operators.pop_back();
+        end = pending.value;
+        if (pending.kind == pendingOperator::kParanthesis)
+            continue;
+
+        astTernaryExpression *expression = (astTernaryExpression*)pending.node;
+        expression->onTrue = operand;
+        operand = 0;
+        if (!isOperator(kOperator_colon)) {
+            fatal("expected `:' for else case in ternary statement");
+            return 0;
+        }
+        if (!next()) return 0; // skip ':'
+        pendingOperator ternaryElse = { pendingOperator::kTernaryElse, 0, expression };
+        m_operators.push_back(ternaryElse);
     }
-    return operand;
 }
 
 CHECK_RETURN astExpression *parser::parseExpression(endCondition condition) {
-    astExpression *lhs = parseUnary(condition);
-    if (!lhs)
-        return 0;
-    if (!next()) // skip last
-        return 0;
-    return parseBinary(0, lhs, condition);
+    // Nested expressions, like arguments of calls, share the stack
+    const size_t operators = m_operators.size();
+    astExpression *expression = parseOperators(condition, operators);
+    if (!expression) {
+        for (size_t i = operators; i < m_operators.size(); i++) {
+            if (m_operators[i].kind != pendingOperator::kTernaryElse)
+                continue;
+            fatal("expected expression after `:' in ternary statement");
+            break;
+        }
+    }
+    m_operators.resize(operators);
+    return expression;
 }
 
 CHECK_RETURN astExpressionStatement *parser::parseExpressionStatement(endCondition condition) {
@@ -1206,10 +1468,15 @@ CHECK_RETURN astExpressionStatement *parser::parseExpressionStatement(endConditi
     return expression ? GC_NEW(astStatement) astExpressionStatement(expression) : 0;
 }
 
-CHECK_RETURN astConstantExpression *parser::parseArraySize() {
+// The size is left 0 for an unsized array
+CHECK_RETURN bool parser::parseArraySize(astConstantExpression *&size) {
+    size = 0;
     if (!next()) // skip '['
-        return 0;
-    return parseExpression(kEndConditionBracket);
+        return false;
+    if (isOperator(kOperator_bracket_end))
+        return true;
+    size = parseExpression(kEndConditionBracket);
+    return size != 0;
 }
 
 CHECK_RETURN astCompoundStatement *parser::parseCompoundStatement() {
@@ -1219,7 +1486,8 @@ CHECK_RETURN astCompoundStatement *parser::parseCompoundStatement() {
     while (!isType(kType_scope_end)) {
         astStatement *nextStatement = parseStatement();
         if (!nextStatement) return 0;
-        statement->statements.push_back(nextStatement);
+        if (!append(statement->statements, nextStatement))
+            return 0;
         if (!next()) // skip ';'
             return 0;
     }
@@ -1241,7 +1509,7 @@ CHECK_RETURN astIfStatement *parser::parseIfStatement() {
     if (!next()) // skip ')'
         return 0;
     statement->thenStatement = parseStatement();
-    token peek = m_lexer.peek();
+    token peek = this->peek();
     if (IS_KEYWORD(peek, kKeyword_else)) {
         if (!next()) // skip ';' or '}'
             return 0;
@@ -1283,11 +1551,13 @@ CHECK_RETURN astSwitchStatement *parser::parseSwitchStatement() {
         if (nextStatement->type == astStatement::kCaseLabel) {
             astCaseLabelStatement *caseLabel = (astCaseLabelStatement*)nextStatement;
             if (!caseLabel->isDefault) {
-                if (!isConstant(caseLabel->condition)) {
+                astConstantExpression *value = 0;
+                if (!evaluate(caseLabel->condition, value))
+                    return 0;
+                if (!value) {
                     fatal("case label is not a valid constant expression");
                     return 0;
                 }
-                astConstantExpression *value = evaluate(caseLabel->condition);
                 // "It is a compile-time error to have two case label constant-expression of equal value"
                 if (value->type == astExpression::kIntConstant) {
                     const int val = IVAL(value);
@@ -1316,7 +1586,8 @@ CHECK_RETURN astSwitchStatement *parser::parseSwitchStatement() {
                 hadDefault = true;
             }
         }
-        statement->statements.push_back(nextStatement);
+        if (!append(statement->statements, nextStatement))
+            return 0;
         if (!next())
             return 0;
     }
@@ -1463,9 +1734,45 @@ CHECK_RETURN astWhileStatement *parser::parseWhileStatement() {
     return statement;
 }
 
-CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondition condition) {
-    m_lexer.backup();
+// A statement is a declaration when it starts with a type, optionally
+// const, followed by a name which may be in parentheses, and then by an
+// initializer, another declaration or the end of the statement. Anything
+// else is an expression. The tokens are looked at without being consumed
+// so the statement is only ever parsed once.
+CHECK_RETURN bool parser::isDeclaration(endCondition condition) {
+    size_t ahead = 0;
+    token type = m_token;
+    if (IS_KEYWORD(type, kKeyword_const))
+        type = peek(ahead++);
+    if (IS_TYPE(type, kType_identifier)) {
+        // Only the current token has been interned so far
+        const char *name = ahead ? intern(m_lexer.identifier(type), type.m_length) : type.asIdentifier;
+        if (!name || !findType(name))
+            return false;
+    } else if (!isBuiltin(type)) {
+        return false;
+    }
 
+    token current = peek(ahead++);
+    size_t paranthesisCount = 0;
+    while (IS_OPERATOR(current, kOperator_paranthesis_begin)) {
+        paranthesisCount++;
+        current = peek(ahead++);
+    }
+    if (!IS_TYPE(current, kType_identifier))
+        return false;
+    current = peek(ahead++);
+    for (size_t i = 0; i < paranthesisCount; i++) {
+        if (!IS_OPERATOR(current, kOperator_paranthesis_end))
+            return false;
+        current = peek(ahead++);
+    }
+    return IS_OPERATOR(current, kOperator_assign)
+        || IS_OPERATOR(current, kOperator_comma)
+        || isEndCondition(current, condition);
+}
+
+CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondition condition) {
     bool isConst = false;
     if (isKeyword(kKeyword_const)) {
         isConst = true;
@@ -1481,7 +1788,7 @@ CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondi
     }
 
     if (!type) {
-        m_lexer.restore();
+        fatal("expected typename in declaration");
         return 0;
     }
 
@@ -1497,30 +1804,23 @@ CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondi
                 return 0;
         }
         if (!isType(kType_identifier)) {
-            m_lexer.restore();
+            fatal("expected name in declaration");
             return 0;
         }
 
-        const char *name = strnew(m_token.asIdentifier);
+        char *name = m_token.asIdentifier;
         if (!next()) // skip identifier
             return 0;
 
         for (size_t i = 0; i < paranthesisCount; i++) {
             if (!isOperator(kOperator_paranthesis_end)) {
-                m_lexer.restore();
+                fatal("expected `)' in declaration");
                 return 0;
             }
             if (!next())
                 return 0;
         }
 
-        if (statement->variables.empty() && !isOperator(kOperator_assign)
-            && !isOperator(kOperator_comma) && !isEndCondition(condition))
-        {
-            m_lexer.restore();
-            return 0;
-        }
-
         astExpression *initialValue = 0;
         if (isOperator(kOperator_assign)) {
             if (!next()) // skip '='
@@ -1532,10 +1832,11 @@ CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondi
         astFunctionVariable *variable = GC_NEW(astVariable) astFunctionVariable();
         variable->isConst = isConst;
         variable->baseType = type;
-        variable->name = strnew(name);
+        variable->name = name;
         variable->initialValue = initialValue;
-        statement->variables.push_back(variable);
-        m_scopes.back().push_back(variable);
+        if (!append(statement->variables, variable))
+            return 0;
+        m_symbols.add(variable);
 
         if (isEndCondition(condition)) {
             break;
@@ -1545,10 +1846,15 @@ CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondi
         } else if (isOperator(kOperator_bracket_begin)) {
             while (isOperator(kOperator_bracket_begin)) {
                 variable->isArray = true;
-                astConstantExpression *arraySize = parseArraySize();
-                if (!arraySize)
+                astConstantExpression *arraySize = 0;
+                if (!parseArraySize(arraySize))
+                    return 0;
+                if (!arraySize) {
+                    fatal("expected array size");
+                    return 0;
+                }
+                if (!append(variable->arraySizes, arraySize))
                     return 0;
-                variable->arraySizes.push_back(arraySize);
                 if (!next()) // skip ']'
                     return 0;
             }
@@ -1562,12 +1868,9 @@ CHECK_RETURN astDeclarationStatement *parser::parseDeclarationStatement(endCondi
 }
 
 CHECK_RETURN astSimpleStatement *parser::parseDeclarationOrExpressionStatement(endCondition condition) {
-    astSimpleStatement *declaration = parseDeclarationStatement(condition);
-    if (declaration) {
-        return declaration;
-    } else {
-        return parseExpressionStatement(condition);
-    }
+    if (isDeclaration(condition))
+        return parseDeclarationStatement(condition);
+    return parseExpressionStatement(condition);
 }
 
 CHECK_RETURN astStatement *parser::parseStatement() {
@@ -1605,7 +1908,7 @@ CHECK_RETURN astStatement *parser::parseStatement() {
 CHECK_RETURN astFunction *parser::parseFunction(const topLevel &parse) {
     astFunction *function = GC_NEW(astFunction) astFunction();
     function->returnType = parse.type;
-    function->name = strnew(parse.name);
+    function->name = parse.name;
 
     if (!next()) // skip '('
         return 0;
@@ -1636,14 +1939,19 @@ CHECK_RETURN astFunction *parser::parseFunction(const topLevel &parse) {
                 parameter->memory = kWriteOnly;
             } else if (isType(kType_identifier)) {
                 // TODO: user defined types
-                parameter->name = strnew(m_token.asIdentifier);
+                parameter->name = m_token.asIdentifier;
             } else if (isOperator(kOperator_bracket_begin)) {
                 while (isOperator(kOperator_bracket_begin)) {
                     parameter->isArray = true;
-                    astConstantExpression *arraySize = parseArraySize();
-                    if (!arraySize)
+                    astConstantExpression *arraySize = 0;
+                    if (!parseArraySize(arraySize))
+                        return 0;
+                    if (!arraySize) {
+                        fatal("expected array size");
+                        return 0;
+                    }
+                    if (!append(parameter->arraySizes, arraySize))
                         return 0;
-                    parameter->arraySizes.push_back(arraySize);
                 }
             } else {
                 parameter->baseType = parseBuiltin();
@@ -1663,7 +1971,8 @@ CHECK_RETURN astFunction *parser::parseFunction(const topLevel &parse) {
             fatal("expected type");
             return 0;
         }
-        function->parameters.push_back(parameter);
+        if (!append(function->parameters, parameter))
+            return 0;
         if (isOperator(kOperator_comma)) {
             if (!next())// skip ','
                 return 0;
@@ -1696,24 +2005,8 @@ CHECK_RETURN astFunction *parser::parseFunction(const topLevel &parse) {
 
     if (isType(kType_scope_begin)) {
         function->isPrototype = false;
-        if (!next()) // skip '{'
+        if (!(defersBodies() ? skipFunctionBody(function) : parseFunctionBody(function)))
             return 0;
-
-        m_scopes.push_back(scope());
-        for (size_t i = 0; i < function->parameters.size(); i++)
-            m_scopes.back().push_back(function->parameters[i]);
-        while (!isType(kType_scope_end)) {
-            astStatement *statement = parseStatement();
-            if (!statement)
-                return 0;
-            else {
-                function->statements.push_back(statement);
-                if (!next())// skip ';'
-                    return 0;
-            }
-        }
-
-        m_scopes.pop_back();
     } else if (isType(kType_semicolon)) {
         function->isPrototype = true;
     } else {
@@ -1723,6 +2016,234 @@ CHECK_RETURN astFunction *parser::parseFunction(const topLevel &parse) {
     return function;
 }
 
+CHECK_RETURN bool parser::parseFunctionBody(astFunction *function) {
+    function->bodyOffset = m_token.m_offset;
+    if (!next()) // skip '{'
+        return false;
+
+    m_symbols.push();
+    for (size_t i = 0; i < function->parameters.size(); i++)
+        m_symbols.add(function->parameters[i]);
+    while (!isType(kType_scope_end)) {
+        astStatement *statement = parseStatement();
+        if (!statement)
+            return false;
+        else {
+            if (!append(function->statements, statement))
+                return false;
+            if (!next())// skip ';'
+                return false;
+        }
+    }
+    m_symbols.pop();
+
+    function->bodyLength = m_token.m_offset + 1 - function->bodyOffset;
+    return true;
+}
+
+CHECK_RETURN bool parser::skipFunctionBody(astFunction *function) {
+    deferredBody body;
+    body.function = function;
+    body.line = m_tokens.line(m_next - 1);
+    body.lineDelta = m_lineDelta;
+    body.globals = m_ast->globals.size();
+    body.structures = m_ast->structures.size();
+    m_deferredBodies.push_back(body);
+
+    // The lexer already left out the inside of the body, but braces are
+    // matched anyway in case it did not
+    function->bodyOffset = m_token.m_offset;
+    function->isDeferred = true;
+    for (size_t depth = 1; depth; ) {
+        if (!next())
+            return false;
+        if (isType(kType_scope_begin))
+            depth++;
+        else if (isType(kType_scope_end))
+            depth--;
+    }
+    function->bodyLength = m_token.m_offset + 1 - function->bodyOffset;
+    return true;
+}
+
+CHECK_RETURN bool parser::parseBody(astFunction *function) {
+    if (!function->isDeferred)
+        return true;
+    // Deferred bodies are in source order
+    size_t begin = 0;
+    size_t end = m_deferredBodies.size();
+    while (begin < end) {
+        const size_t middle = begin + (end - begin) / 2;
+        if (m_deferredBodies[middle].function->bodyOffset < function->bodyOffset)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    if (begin == m_deferredBodies.size() || m_deferredBodies[begin].function != function) {
+        fatal("function `%s' was not parsed by this parser", function->name);
+        return false;
+    }
+    return parseDeferredBody(m_deferredBodies[begin]);
+}
+
+CHECK_RETURN bool parser::parseDeferredBody(const deferredBody &body) {
+    restoreTopLevel(body.globals, body.structures);
+
+    // The tokens of the top level aren't needed anymore
+    m_lexer.tokenizeBody(m_tokens, body.function->bodyOffset, body.line);
+    m_next = 0;
+    m_lineDelta = body.lineDelta;
+    read(); // '{'
+
+    const size_t structures = m_ast->structures.size();
+    if (!parseFunctionBody(body.function)) {
+        // The body stays deferred without the statements parsed before the
+        // error, so trying again starts over. Leave the scopes of the body
+        // behind for restoreTopLevel to clean up.
+        body.function->statements.clear();
+        m_visibleGlobals = ~size_t(0);
+        return false;
+    }
+    // Structures declared in the body went into the index as well
+    if (m_ast->structures.size() != structures)
+        m_visibleStructures = ~size_t(0);
+    body.function->isDeferred = false;
+    return true;
+}
+
+// Put the scope at the top level back the way it was after `globals' and
+// `structures' were declared
+void parser::restoreTopLevel(size_t globals, size_t structures) {
+    if (globals < m_visibleGlobals || structures < m_visibleStructures) {
+        m_symbols.clear();
+        m_symbols.push();
+        for (size_t i = 0; i < m_addedGlobals.size(); i++)
+            m_symbols.add(m_addedGlobals[i]);
+        m_structureIndex.assign(m_structureIndex.size(), (astStruct *)0);
+        m_structureCount = 0;
+        m_visibleGlobals = 0;
+        m_visibleStructures = 0;
+    }
+    for (; m_visibleGlobals < globals; m_visibleGlobals++)
+        m_symbols.add(m_ast->globals[m_visibleGlobals]);
+    for (; m_visibleStructures < structures; m_visibleStructures++)
+        indexStructure(m_ast->structures[m_visibleStructures]);
+}
+
+bool parser::defersBodies() const {
+    return m_lazyBodies || m_bodyThreads != 1;
+}
+
+// Parse every deferred body on a pool of workers, see setBodyThreads. The
+// bodies are handed out in source order and once one fails those after it
+// are left alone, only the first error is reported.
+CHECK_RETURN bool parser::parseBodies() {
+    const size_t count = m_deferredBodies.size();
+    if (!count)
+        return true;
+    size_t threads = m_bodyThreads ? m_bodyThreads : std::thread::hardware_concurrency();
+    if (!threads)
+        threads = 1;
+    if (threads > count)
+        threads = count;
+    while (m_workers.size() < threads)
+        m_workers.push_back(new parser(m_lexer.m_data, m_lexer.m_length, m_fileName, 0, m_atoms));
+
+    std::vector<parsedBody> bodies(count, parsedBody());
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(count); // First body which failed
+    // The calling thread is the first worker, and takes on whatever is left
+    // when fewer threads could be started
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    try {
+        for (size_t i = 1; i < threads; i++)
+            pool.push_back(std::thread(&parser::runWorker, m_workers[i], std::cref(*this), std::ref(next), std::ref(failed), std::ref(bodies)));
+    } catch (const std::system_error &) {
+    }
+    m_workers[0]->runWorker(*this, next, failed, bodies);
+    for (size_t i = 0; i < pool.size(); i++)
+        pool[i].join();
+
+    // The nodes of the bodies must live as long as the rest of the AST. The
+    // workers live as long as the parser and keep their arenas until the
+    // next parse, so only an arena which may outlive the parser takes them.
+    if (m_arena != &m_ownArena) {
+        for (size_t i = 0; i < threads; i++)
+            m_arena->adopt(m_workers[i]->m_ownArena);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const parsedBody &body = bodies[i];
+        if (body.failed) {
+            m_error = strnew(body.worker->m_error);
+            m_errorOccured = true;
+            return false;
+        }
+        for (size_t j = body.structures; j < body.structuresEnd; j++) {
+            if (!append(m_ast->structures, body.worker->m_ast->structures[j]))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Set a worker up for the bodies `owner' deferred. It shares the source and
+// the names of the owner but nothing it changes.
+CHECK_RETURN bool parser::beginWorker(const parser &owner) {
+    reset(owner.m_lexer.m_data, owner.m_lexer.m_length, owner.m_fileName);
+    setPadded(owner.m_lexer.m_padded);
+    m_prelude = owner.m_prelude;
+    m_addedGlobals = owner.m_addedGlobals;
+
+    // Bodies only read the top level, the structures they declare go into
+    // this copy until they are merged
+    const astTU *shared = owner.m_ast;
+    if (!(m_ast = new(m_arena) astTU(shared->type))) {
+        fatal("Out of memory");
+        return false;
+    }
+    for (size_t i = 0; i < shared->functions.size(); i++) {
+        if (!append(m_ast->functions, shared->functions[i]))
+            return false;
+    }
+    for (size_t i = 0; i < shared->globals.size(); i++) {
+        if (!append(m_ast->globals, shared->globals[i]))
+            return false;
+    }
+    for (size_t i = 0; i < shared->structures.size(); i++) {
+        if (!append(m_ast->structures, shared->structures[i]))
+            return false;
+    }
+    // Nothing is in scope yet, see restoreTopLevel
+    m_visibleGlobals = ~size_t(0);
+    return true;
+}
+
+void parser::runWorker(const parser &owner, std::atomic<size_t> &next, std::atomic<size_t> &failed, std::vector<parsedBody> &bodies) {
+    const bool ready = beginWorker(owner);
+    for (;;) {
+        const size_t index = next++;
+        if (index >= bodies.size() || index > failed)
+            return;
+        parsedBody &body = bodies[index];
+        body.worker = this;
+        if (ready) {
+            body.structures = m_ast->structures.size();
+            if (parseDeferredBody(owner.m_deferredBodies[index])) {
+                body.structuresEnd = m_ast->structures.size();
+                continue;
+            }
+        }
+        // This worker's error is that of the body from here on
+        body.failed = true;
+        size_t first = failed;
+        while (index < first && !failed.compare_exchange_weak(first, index))
+            ;
+        return;
+    }
+}
+
 // TODO: cleanup
 #undef TYPENAME
 #define TYPENAME(X) case kKeyword_##X:
@@ -1734,14 +2255,7 @@ astBuiltin *parser::parseBuiltin() {
 
     switch (m_token.asKeyword) {
     #include "glslParser/lexemes.hpp"
-        for (size_t i = 0; i < m_builtins.size(); i++) {
-            if (m_builtins[i]->type == m_token.asKeyword) {
-                return m_builtins[i];
-            }
-        }
-        m_builtins.push_back(GC_NEW(astType) astBuiltin(m_token.asKeyword));
-        return m_builtins.back();
-        break;
+        return astBuiltin::get(m_token.asKeyword);
     default:
         break;
     }
@@ -1766,7 +2280,8 @@ CHECK_RETURN astConstructorCall *parser::parseConstructorCall() {
         astExpression *parameter = parseExpression(kEndConditionComma | kEndConditionParanthesis);
         if (!parameter)
             return 0;
-        expression->parameters.push_back(parameter);
+        if (!append(expression->parameters, parameter))
+            return 0;
         if (isOperator(kOperator_comma)) {
             if (!next()) // skip ','
                 return 0;
@@ -1777,7 +2292,7 @@ CHECK_RETURN astConstructorCall *parser::parseConstructorCall() {
 
 CHECK_RETURN astFunctionCall *parser::parseFunctionCall() {
     astFunctionCall *expression = GC_NEW(astExpression) astFunctionCall();
-    expression->name = strnew(m_token.asIdentifier);
+    expression->name = m_token.asIdentifier;
     if (!next()) // skip identifier
         return 0;
     if (!isOperator(kOperator_paranthesis_begin)) {
@@ -1789,7 +2304,8 @@ CHECK_RETURN astFunctionCall *parser::parseFunctionCall() {
         astExpression *parameter = parseExpression(kEndConditionComma | kEndConditionParanthesis);
         if (!parameter)
             return 0;
-        expression->parameters.push_back(parameter);
+        if (!append(expression->parameters, parameter))
+            return 0;
         if (isOperator(kOperator_comma)) {
             if (!next()) // skip ','
                 return 0;
@@ -1798,14 +2314,40 @@ CHECK_RETURN astFunctionCall *parser::parseFunctionCall() {
     return expression;
 }
 
+void parser::read() {
+    // Stay on the last token once the end of the stream is reached
+    const size_t index = m_next < m_tokens.size() ? m_next++ : m_tokens.size() - 1;
+    m_token = m_tokens[index];
+    // Identifiers are sliced from the source by the lexer, intern them once
+    if (isType(kType_identifier))
+        m_token.asIdentifier = intern(m_lexer.identifier(m_token), m_token.m_length);
+    m_line = int(m_tokens.line(index)) + m_lineDelta;
+}
+
+token parser::peek(size_t ahead) const {
+    const size_t index = m_next + ahead;
+    return m_tokens[index < m_tokens.size() ? index : m_tokens.size() - 1];
+}
+
+// Only the operator of the next token, if it is one, which is cheaper than
+// peeking all of it
+int parser::peekOperator() const {
+    const size_t index = m_next < m_tokens.size() ? m_next : m_tokens.size() - 1;
+    return m_tokens.m_types[index] == kType_operator ? m_tokens.m_payloads[index].asOperator : -1;
+}
+
+bool parser::isLexerError() const {
+    return m_tokens.error() && m_next == m_tokens.size();
+}
+
 CHECK_RETURN bool parser::next() {
-    m_lexer.read(m_token, true);
-    if (isType(kType_eof)) {
-        fatal("premature end of file");
+    read();
+    if (isLexerError()) {
+        fatal("%s", m_tokens.error());
         return false;
     }
-    if (m_lexer.error()) {
-        fatal("%s", m_lexer.error());
+    if (isType(kType_eof)) {
+        fatal("premature end of file");
         return false;
     }
     return true;
@@ -1852,28 +2394,67 @@ astBinaryExpression *parser::createExpression() {
     case kOperator_comma:
         return GC_NEW(astExpression) astSequenceExpression();
     default:
+        fatal("unexpected operator in expression");
         return 0;
     }
 }
 
 astType *parser::findType(const char *name) {
-    for (size_t i = 0; i < m_ast->structures.size(); i++) {
-        if (strcmp(m_ast->structures[i]->name, name))
-            continue;
-        return (astType*)m_ast->structures[i];
-    }
-    return 0;
+    if (m_structureIndex.empty())
+        return 0;
+    return m_structureIndex[findStructureSlot(name)];
 }
 
-astVariable *parser::findVariable(const char *identifier) {
-    for (size_t scopeIndex = m_scopes.size(); scopeIndex > 0; scopeIndex--) {
-        scope &s = m_scopes[scopeIndex - 1];
-        for (size_t variableIndex = 0; variableIndex < s.size(); variableIndex++) {
-            if (!strcmp(s[variableIndex]->name, identifier))
-                return s[variableIndex];
+// Slot of the structure called `name' or the empty slot it would go in
+size_t parser::findStructureSlot(const char *name) const {
+    const size_t mask = m_structureIndex.size() - 1;
+    size_t slot = hashPointer(name) & mask;
+    while (m_structureIndex[slot] && m_structureIndex[slot]->name != name)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+CHECK_RETURN bool parser::addStructure(astStruct *structure) {
+    if (!append(m_ast->structures, structure))
+        return false;
+    indexStructure(structure);
+    return true;
+}
+
+void parser::indexStructure(astStruct *structure) {
+    // Anonymous structures can't be referred to by name
+    if (!structure->name)
+        return;
+    if ((m_structureCount + 1) * 2 > m_structureIndex.size()) {
+        std::vector<astStruct *> structures(m_structureIndex.empty() ? 64 : m_structureIndex.size() * 2, (astStruct *)0);
+        structures.swap(m_structureIndex);
+        for (size_t i = 0; i < structures.size(); i++) {
+            if (structures[i])
+                m_structureIndex[findStructureSlot(structures[i]->name)] = structures[i];
         }
     }
-    return 0;
+    // The first structure of a name is the one found
+    astStruct *&slot = m_structureIndex[findStructureSlot(structure->name)];
+    if (!slot) {
+        slot = structure;
+        m_structureCount++;
+    }
+}
+
+astVariable *parser::findVariable(const char *identifier) {
+    // Built-ins are only looked for when no declaration hides them, by
+    // contents since their names are not interned
+    if (astVariable *variable = m_symbols.find(identifier))
+        return variable;
+    return m_prelude ? m_prelude->find(identifier, strlen(identifier)) : 0;
+}
+
+char *parser::intern(const char *what, size_t length) {
+    // Names in the AST are not const, they must never be written through
+    char *atom = (char *)m_atoms->intern(what, length);
+    if (!atom)
+        fatal("Out of memory");
+    return atom;
 }
 
 const char *parser::error() const {
@@ -1,8 +1,12 @@
 #ifndef PARSE_HDR
 #define PARSE_HDR
 #include <string.h>
+#include <stdlib.h> // malloc, free
+#include <atomic>
 #include "glslParser/lexer.hpp"
 #include "glslParser/ast.hpp"
+#include "glslParser/intern.hpp"
+#include "glslParser/prelude.hpp"
 
 namespace glsl {
 
@@ -47,11 +51,79 @@ struct topLevel {
     char *name;
 };
 
+// Variables in scope at the current point of the parse. Names are interned
+// so they are hashed and compared by address. Each name has one slot which
+// refers to its innermost binding, and every binding remembers the one it
+// shadows so popping a scope can restore it. Slots are never removed, a name
+// going out of scope only leaves its slot without a binding.
+struct symbolTable {
+    symbolTable();
+
+    void push();
+    void pop();
+    void add(astVariable *variable);
+    astVariable *find(const char *name) const;
+    void clear();
+
+private:
+    enum { kNone = ~size_t(0) };
+
+    struct slot {
+        const char *name;
+        size_t binding; // Index into m_bindings or kNone
+    };
+
+    struct binding {
+        astVariable *variable;
+        size_t slot;
+        size_t shadowed; // Binding this one hides or kNone
+    };
+
+    size_t findSlot(const char *name) const;
+    void rehash();
+
+    std::vector<slot> m_slots;
+    size_t m_slotCount; // Slots in use
+    std::vector<binding> m_bindings;
+    std::vector<size_t> m_scopes; // Size of m_bindings as each scope began
+};
+
 struct parser {
     ~parser();
     parser(const char *source, const char *fileName);
+    // The source need not be NUL terminated when its length is given
+    // AST nodes are allocated from `memory' when given, it must outlive
+    // the AST and is not released by the parser. Likewise names are
+    // interned in `atoms' when given, which may be shared between parsers.
+    // Built-in variables are the exception, see prelude.
+    parser(const char *source, size_t length, const char *fileName, arena *memory = 0, internTable *atoms = 0);
+    // The source is followed by lexer::kPadding zero bytes, see lexer::setPadded
+    void setPadded(bool enable);
+    // Start over on another source. The previous AST is discarded but the
+    // memory of the parser is kept, so parsing one shader after another
+    // soon stops allocating.
+    void reset(const char *source, size_t length, const char *fileName);
     CHECK_RETURN astTU *parse(int type, bool ignoreUndefinedVariables = false);
 
+    // Function bodies are skipped by parse() and left for parseBody. Until
+    // then the AST has all declarations and signatures but no statements,
+    // which is all reflection needs and takes a fraction of the time.
+    void setLazyBodies(bool enable);
+    // Parse the statements of a function skipped by parse(), which is done
+    // once. Only what was declared before the function is in scope, just as
+    // if it were parsed in order. A body which fails to parse is left
+    // deferred and without statements.
+    CHECK_RETURN bool parseBody(astFunction *function);
+    // Parse function bodies on this many threads, one per hardware thread
+    // when 0. parse() then gathers the declarations first, as it does for
+    // lazy bodies, and afterwards parses every body concurrently, each worker
+    // with scopes and an arena of its own. The AST and errors come out as if
+    // parsed in order, except that structures declared in bodies follow
+    // those of the top level. With 1, the default, bodies are parsed as they
+    // are met. Lazy bodies are left for parseBody either way.
+    void setBodyThreads(size_t threads);
+
+    // Set whenever parsing failed, 0 otherwise
     const char *error() const;
     inline bool errorOccured() { return m_errorOccured; }
 
@@ -70,7 +142,55 @@ protected:
 
     typedef int endCondition;
 
+    // Declarations being parsed at one level of nesting. The vectors are
+    // kept from one use to the next so their storage is reused.
+    struct scratchItems {
+        scratchItems(parser &owner);
+        ~scratchItems();
+        std::vector<topLevel> &items;
+    private:
+        parser &m_owner;
+    };
+    std::vector<topLevel> &acquireScratchItems();
+
+    // A function body skipped by parse(), with what it needs to be parsed
+    // later
+    struct deferredBody {
+        astFunction *function;
+        size_t line; // Of the `{'
+        int lineDelta;
+        size_t globals; // Declared before the function
+        size_t structures;
+    };
+
+    // What became of a deferred body parsed by a worker, see parseBodies
+    struct parsedBody {
+        parser *worker; // 0 when it was not parsed
+        size_t structures; // Range of the worker's structures declared in it
+        size_t structuresEnd;
+        bool failed;
+    };
+
+    // An operator of an expression being parsed which still waits for an
+    // operand, see parseOperators
+    struct pendingOperator {
+        enum {
+            kBinary, // `value' is the precedence of `node', its left hand side is set
+            kPrefix, // `value' is the operator
+            kParanthesis, // `value' is the end condition outside
+            kTernary, // Condition of `node' parsed, `value' is the end condition outside
+            kTernaryElse // Only the else case of `node' is left
+        };
+        int kind;
+        int value;
+        astExpression *node;
+    };
+
     CHECK_RETURN bool next();
+    void read();
+    token peek(size_t ahead = 0) const;
+    int peekOperator() const;
+    bool isLexerError() const;
 
     CHECK_RETURN bool parseStorage(topLevel &current); // const, in, out, attribute, uniform, varying, buffer, shared
     CHECK_RETURN bool parseAuxiliary(topLevel &current); // centroid, sample, patch
@@ -83,19 +203,24 @@ protected:
 
     CHECK_RETURN bool parseTopLevelItem(topLevel &level, topLevel *continuation = 0);
     CHECK_RETURN bool parseTopLevel(std::vector<topLevel> &top);
+    CHECK_RETURN bool parseTranslationUnit();
 
     CHECK_RETURN bool isType(int type) const;
     CHECK_RETURN bool isKeyword(int keyword) const;
     CHECK_RETURN bool isOperator(int oper) const;
     CHECK_RETURN bool isEndCondition(endCondition condition) const;
+    CHECK_RETURN bool isEndCondition(const token &value, endCondition condition) const;
     CHECK_RETURN bool isBuiltin() const;
+    CHECK_RETURN bool isBuiltin(const token &value) const;
 
     CHECK_RETURN bool isConstantValue(astExpression *expression) const;
-    CHECK_RETURN bool isConstant(astExpression *expression) const;
 
     void fatal(const char *fmt, ...);
 
-    CHECK_RETURN astConstantExpression *evaluate(astExpression *expression);
+    CHECK_RETURN bool evaluate(astExpression *expression, astConstantExpression *&value);
+    astConstantExpression *foldNegation(astConstantExpression *operand);
+    astConstantExpression *foldPlus(astConstantExpression *operand);
+    astConstantExpression *foldOperation(int operation, astConstantExpression *lhs, astConstantExpression *rhs);
     int preprocess();
 
     // Type parsers
@@ -103,6 +228,14 @@ protected:
     astStruct *parseStruct();
 
     CHECK_RETURN astFunction *parseFunction(const topLevel &parse);
+    CHECK_RETURN bool parseFunctionBody(astFunction *function);
+    CHECK_RETURN bool skipFunctionBody(astFunction *function);
+    CHECK_RETURN bool parseDeferredBody(const deferredBody &body);
+    void restoreTopLevel(size_t globals, size_t structures);
+    bool defersBodies() const;
+    CHECK_RETURN bool parseBodies();
+    CHECK_RETURN bool beginWorker(const parser &owner);
+    void runWorker(const parser &owner, std::atomic<size_t> &next, std::atomic<size_t> &failed, std::vector<parsedBody> &bodies);
 
     // Call parsers
     CHECK_RETURN astConstructorCall *parseConstructorCall();
@@ -110,10 +243,12 @@ protected:
 
     // Expression parsers
     CHECK_RETURN astExpression *parseExpression(endCondition end);
-    CHECK_RETURN astExpression *parseUnary(endCondition end);
-    CHECK_RETURN astExpression *parseBinary(int lhsPrecedence, astExpression *lhs, endCondition condition);
-    CHECK_RETURN astExpression *parseUnaryPrefix(endCondition end);
-    CHECK_RETURN astConstantExpression *parseArraySize();
+    CHECK_RETURN astExpression *parseOperators(endCondition end, size_t base);
+    CHECK_RETURN astExpression *parseFieldOrSwizzle(astExpression *operand);
+    CHECK_RETURN astExpression *parseArraySubscript(astExpression *operand);
+    CHECK_RETURN astExpression *parsePrimary();
+    CHECK_RETURN bool parseArraySize(astConstantExpression *&size);
+    CHECK_RETURN bool checkAssignment(astExpression *lhs);
 
     // Statement parsers
     CHECK_RETURN astStatement *parseStatement();
@@ -123,6 +258,7 @@ protected:
     CHECK_RETURN astCompoundStatement *parseCompoundStatement();
     CHECK_RETURN astIfStatement *parseIfStatement();
     CHECK_RETURN astSimpleStatement *parseDeclarationOrExpressionStatement(endCondition condition);
+    CHECK_RETURN bool isDeclaration(endCondition condition);
     CHECK_RETURN astDeclarationStatement *parseDeclarationStatement(endCondition condition);
     CHECK_RETURN astExpressionStatement *parseExpressionStatement(endCondition condition);
     CHECK_RETURN astContinueStatement *parseContinueStatement();
@@ -135,19 +271,35 @@ protected:
     astBinaryExpression *createExpression();
 
     astType *findType(const char *identifier);
+    size_t findStructureSlot(const char *name) const;
+    CHECK_RETURN bool addStructure(astStruct *structure);
+    void indexStructure(astStruct *structure);
     astVariable *findVariable(const char *identifier);
     astType* getType(astExpression *expression);
 private:
-    typedef std::vector<astVariable *> scope;
-
-    scope m_toAddGlobal;
-    void m_addBuiltinVariables();
+    std::vector<astVariable *> m_toAddGlobal;
+    std::vector<astVariable *> m_addedGlobals; // Of the last parse
 
     astTU *m_ast;
     lexer m_lexer;
+    tokenStream m_tokens;
+    size_t m_next; // Index of the token after m_token in m_tokens
+    int m_lineDelta; // Adjustment made by #line
+    int m_line; // Line of the current token, given to nodes as they are built
     token m_token;
-    std::vector<scope> m_scopes;
-    std::vector<astBuiltin*> m_builtins;
+    symbolTable m_symbols;
+    const prelude *m_prelude; // Built-in variables of the stage being parsed
+    std::vector<astStruct*> m_structureIndex; // Hash table of structures by interned name
+    size_t m_structureCount;
+    std::vector<std::vector<topLevel> *> m_scratchItems; // By depth, see scratchItems
+    size_t m_scratchDepth;
+    std::vector<pendingOperator> m_operators; // Shared by nested expressions, see parseExpression
+    bool m_lazyBodies;
+    std::vector<deferredBody> m_deferredBodies; // In source order
+    size_t m_visibleGlobals; // In scope at the top level, see restoreTopLevel
+    size_t m_visibleStructures;
+    size_t m_bodyThreads;
+    std::vector<parser *> m_workers; // Parse bodies for parseBodies
     bool m_errorOccured;
     char *m_error;
     char *m_oom;
@@ -174,10 +326,37 @@ private:
         return !what || !*what;
     }
 
-    std::vector<astMemory> m_memory; // Memory of AST held here
+    char *intern(const char *what, size_t length);
+
+    // Grow AST arrays in the parser's arena
+    template <typename T>
+    CHECK_RETURN bool append(astArray<T> &array, const T &value);
+    template <typename T>
+    CHECK_RETURN bool assign(astArray<T> &array, const std::vector<T> &values);
+
+    arena m_ownArena;
+    arena *m_arena; // Memory of AST held here
     std::vector<char *> m_strings; // Memory of strings held here
+    internTable m_ownAtoms;
+    internTable *m_atoms; // Every name in the AST is interned here, but those of built-ins
 };
 
+template <typename T>
+inline bool parser::append(astArray<T> &array, const T &value) {
+    if (array.push_back(m_arena, value))
+        return true;
+    fatal("Out of memory");
+    return false;
+}
+
+template <typename T>
+inline bool parser::assign(astArray<T> &array, const std::vector<T> &values) {
+    if (array.assign(m_arena, values))
+        return true;
+    fatal("Out of memory");
+    return false;
+}
+
 }
 
 #endif
@@ -0,0 +1,167 @@
+#include "glslParser/prelude.hpp"
+#include "glslParser/lexer.hpp" // kKeyword_*
+
+namespace glsl {
+
+enum {
+    kStageCompute = 1 << astTU::kCompute,
+    kStageVertex = 1 << astTU::kVertex,
+    kStageTessControl = 1 << astTU::kTessControl,
+    kStageTessEvaluation = 1 << astTU::kTessEvaluation,
+    kStageGeometry = 1 << astTU::kGeometry,
+    kStageFragment = 1 << astTU::kFragment,
+    kStageAll = (1 << (astTU::kFragment + 1)) - 1
+};
+
+enum {
+    kNotArray = 0,
+    kUnsized = -1
+};
+
+static const struct builtinVariable {
+    const char *name;
+    int type; // kKeyword_*
+    int storage;
+    int arraySize; // kNotArray, kUnsized or the size
+    int value; // For constants
+    int stages;
+} kBuiltinVariables[] = {
+    // Compute inputs
+    { "gl_NumWorkGroups",        kKeyword_uvec3, kIn,  kNotArray, 0, kStageCompute },
+    { "gl_WorkGroupID",          kKeyword_uvec3, kIn,  kNotArray, 0, kStageCompute },
+    { "gl_LocalInvocationID",    kKeyword_uvec3, kIn,  kNotArray, 0, kStageCompute },
+    { "gl_GlobalInvocationID",   kKeyword_uvec3, kIn,  kNotArray, 0, kStageCompute },
+    { "gl_LocalInvocationIndex", kKeyword_uint,  kIn,  kNotArray, 0, kStageCompute },
+
+    // Vertex inputs
+    { "gl_VertexID",             kKeyword_int,   kIn,  kNotArray, 0, kStageVertex },
+    { "gl_InstanceID",           kKeyword_int,   kIn,  kNotArray, 0, kStageVertex },
+    { "gl_DrawID",               kKeyword_int,   kIn,  kNotArray, 0, kStageVertex },
+    { "gl_BaseVertex",           kKeyword_int,   kIn,  kNotArray, 0, kStageVertex },
+    { "gl_BaseInstance",         kKeyword_int,   kIn,  kNotArray, 0, kStageVertex },
+
+    // Tessellation and geometry inputs
+    { "gl_PatchVerticesIn",      kKeyword_int,   kIn,  kNotArray, 0, kStageTessControl | kStageTessEvaluation },
+    { "gl_PrimitiveID",          kKeyword_int,   kIn,  kNotArray, 0, kStageTessControl | kStageTessEvaluation | kStageFragment },
+    { "gl_InvocationID",         kKeyword_int,   kIn,  kNotArray, 0, kStageTessControl | kStageGeometry },
+    { "gl_TessCoord",            kKeyword_vec3,  kIn,  kNotArray, 0, kStageTessEvaluation },
+    { "gl_TessLevelOuter",       kKeyword_float, kIn,  4,         0, kStageTessEvaluation },
+    { "gl_TessLevelInner",       kKeyword_float, kIn,  2,         0, kStageTessEvaluation },
+    { "gl_PrimitiveIDIn",        kKeyword_int,   kIn,  kNotArray, 0, kStageGeometry },
+
+    // Vertex processing outputs
+    { "gl_Position",             kKeyword_vec4,  kOut, kNotArray, 0, kStageVertex | kStageTessEvaluation | kStageGeometry },
+    { "gl_PointSize",            kKeyword_float, kOut, kNotArray, 0, kStageVertex | kStageTessEvaluation | kStageGeometry },
+    { "gl_ClipDistance",         kKeyword_float, kOut, kUnsized,  0, kStageVertex | kStageTessEvaluation | kStageGeometry },
+    { "gl_CullDistance",         kKeyword_float, kOut, kUnsized,  0, kStageVertex | kStageTessEvaluation | kStageGeometry },
+    { "gl_TessLevelOuter",       kKeyword_float, kOut, 4,         0, kStageTessControl },
+    { "gl_TessLevelInner",       kKeyword_float, kOut, 2,         0, kStageTessControl },
+    { "gl_PrimitiveID",          kKeyword_int,   kOut, kNotArray, 0, kStageGeometry },
+    { "gl_Layer",                kKeyword_int,   kOut, kNotArray, 0, kStageGeometry },
+    { "gl_ViewportIndex",        kKeyword_int,   kOut, kNotArray, 0, kStageGeometry },
+
+    // Fragment inputs
+    { "gl_FragCoord",            kKeyword_vec4,  kIn,  kNotArray, 0, kStageFragment },
+    { "gl_FrontFacing",          kKeyword_bool,  kIn,  kNotArray, 0, kStageFragment },
+    { "gl_ClipDistance",         kKeyword_float, kIn,  kUnsized,  0, kStageFragment },
+    { "gl_CullDistance",         kKeyword_float, kIn,  kUnsized,  0, kStageFragment },
+    { "gl_PointCoord",           kKeyword_vec2,  kIn,  kNotArray, 0, kStageFragment },
+    { "gl_SampleID",             kKeyword_int,   kIn,  kNotArray, 0, kStageFragment },
+    { "gl_SamplePosition",       kKeyword_vec2,  kIn,  kNotArray, 0, kStageFragment },
+    { "gl_SampleMaskIn",         kKeyword_int,   kIn,  kUnsized,  0, kStageFragment },
+    { "gl_Layer",                kKeyword_int,   kIn,  kNotArray, 0, kStageFragment },
+    { "gl_ViewportIndex",        kKeyword_int,   kIn,  kNotArray, 0, kStageFragment },
+    { "gl_HelperInvocation",     kKeyword_bool,  kIn,  kNotArray, 0, kStageFragment },
+
+    // Fragment outputs
+    { "gl_FragDepth",            kKeyword_float, kOut, kNotArray, 0, kStageFragment },
+    { "gl_SampleMask",           kKeyword_int,   kOut, kUnsized,  0, kStageFragment },
+
+    // Implementation limits, at the minimum values required by the
+    // specification
+    { "gl_MaxVertexAttribs",                  kKeyword_int, kConst, kNotArray, 16,   kStageAll },
+    { "gl_MaxVertexUniformVectors",           kKeyword_int, kConst, kNotArray, 256,  kStageAll },
+    { "gl_MaxVertexUniformComponents",        kKeyword_int, kConst, kNotArray, 1024, kStageAll },
+    { "gl_MaxVertexOutputComponents",         kKeyword_int, kConst, kNotArray, 64,   kStageAll },
+    { "gl_MaxVaryingComponents",              kKeyword_int, kConst, kNotArray, 60,   kStageAll },
+    { "gl_MaxVaryingVectors",                 kKeyword_int, kConst, kNotArray, 15,   kStageAll },
+    { "gl_MaxVertexTextureImageUnits",        kKeyword_int, kConst, kNotArray, 16,   kStageAll },
+    { "gl_MaxCombinedTextureImageUnits",      kKeyword_int, kConst, kNotArray, 80,   kStageAll },
+    { "gl_MaxTextureImageUnits",              kKeyword_int, kConst, kNotArray, 16,   kStageAll },
+    { "gl_MaxFragmentInputComponents",        kKeyword_int, kConst, kNotArray, 128,  kStageAll },
+    { "gl_MaxFragmentUniformVectors",         kKeyword_int, kConst, kNotArray, 256,  kStageAll },
+    { "gl_MaxFragmentUniformComponents",      kKeyword_int, kConst, kNotArray, 1024, kStageAll },
+    { "gl_MaxDrawBuffers",                    kKeyword_int, kConst, kNotArray, 8,    kStageAll },
+    { "gl_MaxClipDistances",                  kKeyword_int, kConst, kNotArray, 8,    kStageAll },
+    { "gl_MaxCullDistances",                  kKeyword_int, kConst, kNotArray, 8,    kStageAll },
+    { "gl_MaxCombinedClipAndCullDistances",   kKeyword_int, kConst, kNotArray, 8,    kStageAll },
+    { "gl_MaxGeometryInputComponents",        kKeyword_int, kConst, kNotArray, 64,   kStageAll },
+    { "gl_MaxGeometryOutputComponents",       kKeyword_int, kConst, kNotArray, 128,  kStageAll },
+    { "gl_MaxGeometryOutputVertices",         kKeyword_int, kConst, kNotArray, 256,  kStageAll },
+    { "gl_MaxGeometryTotalOutputComponents",  kKeyword_int, kConst, kNotArray, 1024, kStageAll },
+    { "gl_MaxPatchVertices",                  kKeyword_int, kConst, kNotArray, 32,   kStageAll },
+    { "gl_MaxTessGenLevel",                   kKeyword_int, kConst, kNotArray, 64,   kStageAll },
+    { "gl_MaxViewports",                      kKeyword_int, kConst, kNotArray, 16,   kStageAll },
+    { "gl_MaxSamples",                        kKeyword_int, kConst, kNotArray, 4,    kStageAll }
+};
+
+const prelude &prelude::get(int stage) {
+    // Built on first use, which the language makes safe across threads
+    static const prelude kCompute(astTU::kCompute);
+    static const prelude kVertex(astTU::kVertex);
+    static const prelude kTessControl(astTU::kTessControl);
+    static const prelude kTessEvaluation(astTU::kTessEvaluation);
+    static const prelude kGeometry(astTU::kGeometry);
+    static const prelude kFragment(astTU::kFragment);
+    switch (stage) {
+    case astTU::kCompute:        return kCompute;
+    case astTU::kVertex:         return kVertex;
+    case astTU::kTessControl:    return kTessControl;
+    case astTU::kTessEvaluation: return kTessEvaluation;
+    case astTU::kGeometry:       return kGeometry;
+    default:                     return kFragment;
+    }
+}
+
+prelude::prelude(int stage)
+    : m_entries(build(stage, &m_memory))
+    , m_index(m_entries.data(), m_entries.size(), &entry::name)
+{
+}
+
+std::vector<prelude::entry> prelude::build(int stage, arena *memory) {
+    std::vector<entry> entries;
+    for (size_t i = 0; i < sizeof(kBuiltinVariables)/sizeof(kBuiltinVariables[0]); i++) {
+        const builtinVariable &builtin = kBuiltinVariables[i];
+        if (!(builtin.stages & (1 << stage)))
+            continue;
+        astGlobalVariable *variable = new(memory) astGlobalVariable();
+        if (!variable)
+            break;
+        // Names in the AST are not const, they must never be written through
+        variable->name = (char *)builtin.name;
+        variable->baseType = astBuiltin::get(builtin.type);
+        variable->storage = builtin.storage;
+        variable->precision = kHighp;
+        if (builtin.storage == kConst && !(variable->initialValue = new(memory) astIntConstant(builtin.value)))
+            break;
+        if (builtin.arraySize != kNotArray) {
+            variable->isArray = true;
+            if (builtin.arraySize != kUnsized) {
+                astConstantExpression *size = new(memory) astIntConstant(builtin.arraySize);
+                if (!size || !variable->arraySizes.push_back(memory, size))
+                    break;
+            }
+        }
+        const entry next = { builtin.name, variable };
+        entries.push_back(next);
+    }
+    return entries;
+}
+
+astGlobalVariable *prelude::find(const char *name, size_t length) const {
+    const int index = m_index.find(name, length, hashString(name, length));
+    return index == -1 ? 0 : m_entries[index].variable;
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef PRELUDE_HDR
+#define PRELUDE_HDR
+#include <stddef.h> // size_t
+#include <vector>
+
+#include "glslParser/ast.hpp"
+#include "glslParser/util.hpp"
+
+namespace glsl {
+
+// The built-in variables of one shader stage. A stage's prelude is built
+// the first time it's asked for and never changes after, so every parser
+// for that stage, on any thread, shares the same one. Built-ins are in scope
+// outside of the global scope of a shader, which may redeclare them.
+//
+// Since parsers with different intern tables share a prelude, the names of
+// built-ins are static strings which are not interned in any of them. A
+// built-in referred to in an AST has a name equal by contents but never by
+// address to the identifier which named it, so compare them with strcmp.
+struct prelude {
+    // `stage' is one of astTU::kCompute ... astTU::kFragment
+    static const prelude &get(int stage);
+
+    // The built-in called `name' or 0 if this stage has none of that name
+    astGlobalVariable *find(const char *name, size_t length) const;
+
+    size_t size() const;
+    astGlobalVariable *operator[](size_t index) const;
+
+private:
+    prelude(int stage);
+    prelude(const prelude&);
+    prelude &operator=(const prelude&);
+
+    struct entry {
+        const char *name;
+        astGlobalVariable *variable;
+    };
+
+    static std::vector<entry> build(int stage, arena *memory);
+
+    arena m_memory; // Holds the variables and their array sizes
+    std::vector<entry> m_entries;
+    perfectHash m_index;
+};
+
+inline size_t prelude::size() const {
+    return m_entries.size();
+}
+
+inline astGlobalVariable *prelude::operator[](size_t index) const {
+    return m_entries[index].variable;
+}
+
+}
+
+#endif
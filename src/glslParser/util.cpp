@@ -1,6 +1,9 @@
 #include <stdarg.h> // va_list, va_copy, va_start, va_end
-#include <stdlib.h> // malloc
-#include <stdio.h>  // vsnprintf
+#include <stdlib.h> // malloc, abort
+#include <stdio.h>  // vsnprintf, fprintf
+#include <string.h> // strlen, strcmp, memcmp
+
+#include "glslParser/util.hpp"
 
 namespace glsl {
 
@@ -29,4 +32,102 @@ int allocfmt(char **str, const char *fmt, ...) {
     return size;
 }
 
+/// perfectHash
+static inline unsigned mixHash(unsigned hash, unsigned seed) {
+    hash ^= seed * 0x9E3779B9u;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+void perfectHash::build() {
+    const size_t count = m_keys.size();
+    std::vector<unsigned> hashes(count);
+    m_lengths.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        m_lengths[i] = strlen(m_keys[i]);
+        hashes[i] = hashString(m_keys[i], m_lengths[i]);
+    }
+
+    // Keys of the same hash are never told apart by a displacement and no
+    // table would ever be large enough to place them
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            if (hashes[i] != hashes[j])
+                continue;
+            fprintf(stderr, "perfect hash keys `%s' and `%s' %s\n", m_keys[i], m_keys[j],
+                strcmp(m_keys[i], m_keys[j]) ? "collide" : "are the same");
+            abort();
+        }
+    }
+
+    // Aim for a load factor of about 0.8 with four keys per bucket
+    size_t slotCount = 4;
+    while (slotCount < count + count / 4)
+        slotCount *= 2;
+
+    for (;;) {
+        const size_t bucketCount = slotCount / 4;
+        m_slotMask = unsigned(slotCount - 1);
+        m_bucketMask = unsigned(bucketCount - 1);
+        m_slots.assign(slotCount, -1);
+        m_displacements.assign(bucketCount, 0);
+
+        std::vector<std::vector<int> > buckets(bucketCount);
+        size_t largest = 0;
+        for (size_t i = 0; i < count; i++) {
+            std::vector<int> &bucket = buckets[mixHash(hashes[i], 0) & m_bucketMask];
+            bucket.push_back(int(i));
+            if (bucket.size() > largest)
+                largest = bucket.size();
+        }
+
+        // Place the largest buckets first while the table is still sparse,
+        // searching for a displacement which maps all of a bucket's keys to
+        // free slots
+        bool placed = true;
+        std::vector<unsigned> candidates;
+        for (size_t size = largest; size && placed; size--) {
+            for (size_t b = 0; b < bucketCount && placed; b++) {
+                const std::vector<int> &bucket = buckets[b];
+                if (bucket.size() != size)
+                    continue;
+                placed = false;
+                for (unsigned displacement = 1; displacement < 0x10000 && !placed; displacement++) {
+                    candidates.clear();
+                    for (size_t k = 0; k < size; k++) {
+                        const unsigned slot = mixHash(hashes[bucket[k]], displacement) & m_slotMask;
+                        if (m_slots[slot] != -1 || glsl::find(candidates.begin(), candidates.end(), slot) != candidates.end())
+                            break;
+                        candidates.push_back(slot);
+                    }
+                    if (candidates.size() != size)
+                        continue;
+                    for (size_t k = 0; k < size; k++)
+                        m_slots[candidates[k]] = bucket[k];
+                    m_displacements[b] = displacement;
+                    placed = true;
+                }
+            }
+        }
+
+        if (placed)
+            return;
+
+        // Too crowded, try again with a sparser table
+        slotCount *= 2;
+    }
+}
+
+int perfectHash::find(const char *data, size_t length, unsigned hash) const {
+    const unsigned displacement = m_displacements[mixHash(hash, 0) & m_bucketMask];
+    const int index = m_slots[mixHash(hash, displacement) & m_slotMask];
+    if (index == -1 || m_lengths[index] != length || memcmp(m_keys[index], data, length))
+        return -1;
+    return index;
+}
+
 }
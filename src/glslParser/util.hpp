@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 #include <stdarg.h> // va_list
+#include <stddef.h> // size_t
 #include <vector>
 
 namespace glsl {
@@ -19,6 +20,62 @@ int allocvfmt(char **str, const char *fmt, va_list vp);
 
 // An implementation of vsprintf
 int allocfmt(char **str, const char *fmt, ...);
+
+// FNV-1a string hashing, usable incrementally one character at a time
+enum { kHashBasis = 2166136261u };
+
+static inline unsigned hashAppend(unsigned hash, int ch) {
+    return (hash ^ (unsigned char)ch) * 16777619u;
+}
+
+static inline unsigned hashString(const char *data, size_t length) {
+    unsigned hash = kHashBasis;
+    for (size_t i = 0; i < length; i++)
+        hash = hashAppend(hash, data[i]);
+    return hash;
+}
+
+// Hashing of addresses, mostly interned strings. Fibonacci hashing spreads
+// the bits since the low ones of an address are mostly alignment.
+static inline size_t hashPointer(const void *pointer) {
+    return size_t((unsigned long long)(size_t)pointer * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+// A perfect hash over a fixed set of strings, built with the hash-and-
+// displace method. It is not minimal, at least a fifth of the table is left
+// empty so a displacement for every bucket is quick to find. A lookup costs
+// two integer mixes and at most one string compare. The keys must be
+// distinct, building aborts otherwise.
+struct perfectHash {
+    template <typename T>
+    perfectHash(const T *table, size_t count, const char *const T::*key);
+
+    // Index of the key in the table it was built from or -1 if not present.
+    // `hash' must be hashString(data, length).
+    int find(const char *data, size_t length, unsigned hash) const;
+
+private:
+    void build();
+
+    std::vector<const char *> m_keys;
+    std::vector<size_t> m_lengths;
+    std::vector<unsigned> m_displacements;
+    std::vector<int> m_slots;
+    unsigned m_bucketMask;
+    unsigned m_slotMask;
+};
+
+template <typename T>
+inline perfectHash::perfectHash(const T *table, size_t count, const char *const T::*key)
+    : m_bucketMask(0)
+    , m_slotMask(0)
+{
+    m_keys.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        m_keys.push_back(table[i].*key);
+    build();
+}
+
 }
 
 #endif
@@ -0,0 +1,133 @@
+#include "gtest/gtest.h"
+#include "glslParser/arena.hpp"
+#include "glslParser/parser.hpp"
+
+#include <string>
+#include <type_traits>
+
+namespace {
+
+TEST(Arena, AllocationsAreAlignedAndDistinct) {
+    glsl::arena memory;
+    char *previous = nullptr;
+    for (size_t size = 1; size < 100; size++) {
+        char *data = (char *)memory.allocate(size);
+        ASSERT_NE(data, nullptr);
+        EXPECT_EQ((size_t)data % sizeof(void*), 0u);
+        if (previous) {
+            EXPECT_NE(data, previous);
+        }
+        memset(data, 0xCC, size);
+        previous = data;
+    }
+    EXPECT_EQ(memory.blocks(), 1u);
+}
+
+TEST(Arena, ManySmallAllocationsUseFewBlocks) {
+    glsl::arena memory;
+    for (size_t i = 0; i < 100000; i++)
+        ASSERT_NE(memory.allocate(48), nullptr);
+    EXPECT_LE(memory.blocks(), 8u);
+    memory.release();
+    EXPECT_EQ(memory.blocks(), 0u);
+    EXPECT_NE(memory.allocate(16), nullptr);
+}
+
+TEST(Arena, LargeAllocationsGetTheirOwnBlock) {
+    glsl::arena memory;
+    char *small = (char *)memory.allocate(16);
+    char *large = (char *)memory.allocate(1 << 20);
+    char *next = (char *)memory.allocate(16);
+    ASSERT_NE(large, nullptr);
+    memset(large, 0, 1 << 20);
+    EXPECT_EQ(memory.blocks(), 2u);
+    // Small allocations carry on in the block they were using
+    EXPECT_EQ(next, small + 16);
+}
+
+TEST(Arena, ResetKeepsOneMergedBlock) {
+    glsl::arena memory;
+    for (size_t i = 0; i < 100000; i++)
+        ASSERT_NE(memory.allocate(48), nullptr);
+    ASSERT_GT(memory.blocks(), 1u);
+    memory.reset();
+    EXPECT_EQ(memory.blocks(), 1u);
+    // The merged block is large enough for the same work again
+    char *first = (char *)memory.allocate(48);
+    for (size_t i = 1; i < 100000; i++)
+        ASSERT_NE(memory.allocate(48), nullptr);
+    EXPECT_EQ(memory.blocks(), 1u);
+    memory.reset();
+    EXPECT_EQ(memory.allocate(48), first);
+}
+
+TEST(Arena, AdoptTakesOverBlocks) {
+    glsl::arena memory;
+    glsl::arena other;
+    char *small = (char *)memory.allocate(16);
+    for (size_t i = 0; i < 100000; i++)
+        ASSERT_NE(other.allocate(48), nullptr);
+    const size_t blocks = other.blocks();
+    memory.adopt(other);
+    EXPECT_EQ(memory.blocks(), blocks + 1);
+    EXPECT_EQ(other.blocks(), 0u);
+    // Allocation carries on in the block it was using
+    EXPECT_EQ(memory.allocate(16), small + 16);
+    memory.reset();
+    EXPECT_EQ(memory.blocks(), 1u);
+
+    // Adopting into an empty arena carries on in the adopted block
+    glsl::arena empty;
+    char *last = (char *)other.allocate(16);
+    empty.adopt(other);
+    EXPECT_EQ(empty.allocate(16), last + 16);
+}
+
+TEST(Arena, ParserAllocatesNodesFromGivenArena) {
+    std::string source = "void main() {\n";
+    for (int i = 0; i < 5000; i++)
+        source += "    float v" + std::to_string(i) + " = 1.0 + 2.0 * 3.0;\n";
+    source += "}\n";
+
+    glsl::arena memory;
+    {
+        glsl::parser q(source.c_str(), source.size(), "arena", &memory);
+        ASSERT_NE(q.parse(glsl::astTU::kFragment), nullptr) << q.error();
+        EXPECT_GT(memory.blocks(), 0u);
+        EXPECT_LE(memory.blocks(), 8u);
+    }
+    // The parser leaves an arena it was given alone
+    EXPECT_GT(memory.blocks(), 0u);
+}
+
+
+TEST(Arena, AstIsTriviallyDestructible) {
+    // Releasing the arena must be all it takes to tear down an AST
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astTU>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astStruct>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astGlobalVariable>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astFunctionVariable>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astFunctionParameter>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astFunction>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astCompoundStatement>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astDeclarationStatement>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astSwitchStatement>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astFunctionCall>::value);
+    EXPECT_TRUE(std::is_trivially_destructible<glsl::astConstructorCall>::value);
+}
+
+TEST(Arena, AstArrayGrowsInArena) {
+    glsl::arena memory;
+    glsl::astArray<int> values;
+    for (int i = 0; i < 1000; i++)
+        ASSERT_TRUE(values.push_back(&memory, i));
+    ASSERT_EQ(values.size(), 1000u);
+    for (int i = 0; i < 1000; i++)
+        EXPECT_EQ(values[i], i);
+    values.pop_back();
+    EXPECT_EQ(values.back(), 998);
+    ASSERT_TRUE(values.assign(&memory, std::vector<int>{ 1, 2, 3 }));
+    EXPECT_EQ(values.size(), 3u);
+    EXPECT_EQ(values[2], 3);
+}
+}
@@ -0,0 +1,86 @@
+#include "gtest/gtest.h"
+#include "glslParser/batch.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+TEST(Batch, ResultsMatchJobs) {
+    // Sources of very different sizes so workers finish at different times
+    std::vector<std::string> sources;
+    for (int i = 0; i < 200; i++) {
+        std::string source;
+        for (int j = 0; j <= i % 37 * 4; j++)
+            source += "float f" + std::to_string(j) + "() { return " + std::to_string(i) + ".0; }\n";
+        if (i % 10 == 3)
+            source += "void broken() { undefined; }\n";
+        sources.push_back(source);
+    }
+    std::vector<glsl::parseJob> jobs;
+    for (size_t i = 0; i < sources.size(); i++) {
+        glsl::parseJob job = { sources[i].data(), sources[i].size(), glsl::astTU::kFragment, "batch" };
+        jobs.push_back(job);
+    }
+
+    glsl::parseBatch batch(4);
+    EXPECT_EQ(batch.threads(), 4u);
+    std::vector<glsl::parseResult> results;
+    for (int pass = 0; pass < 2; pass++) {
+        batch.parse(jobs, results);
+        ASSERT_EQ(results.size(), jobs.size());
+        for (int i = 0; i < 200; i++) {
+            if (i % 10 == 3) {
+                EXPECT_EQ(results[i].ast, nullptr);
+                ASSERT_NE(results[i].error, nullptr);
+                EXPECT_NE(std::string(results[i].error).find("not declared"), std::string::npos);
+                continue;
+            }
+            ASSERT_NE(results[i].ast, nullptr) << results[i].error;
+            EXPECT_EQ(results[i].ast->functions.size(), size_t(i % 37 * 4 + 1));
+        }
+    }
+}
+
+TEST(Batch, TruncatedSources) {
+    // Every prefix of a shader, most of which end in the middle of something
+    const std::string source =
+        "layout(location = 0) uniform vec4 color[2];\n"
+        "out vec4 result;\n"
+        "void main() { result = color[1] * 2.0; }\n";
+    std::vector<glsl::parseJob> jobs;
+    for (size_t length = 1; length < source.size(); length++) {
+        glsl::parseJob job = { source.data(), length, glsl::astTU::kFragment, "truncated" };
+        jobs.push_back(job);
+    }
+    glsl::parseBatch batch(2);
+    std::vector<glsl::parseResult> results;
+    batch.parse(jobs, results);
+    ASSERT_EQ(results.size(), jobs.size());
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].ast)
+            continue;
+        ASSERT_NE(results[i].error, nullptr);
+        EXPECT_EQ(std::string(results[i].error).find("truncated:"), 0u) << results[i].error;
+    }
+    EXPECT_NE(results.back().ast, nullptr) << results.back().error;
+}
+
+TEST(Batch, MoreThreadsThanJobs) {
+    const std::string source = "uniform vec4 color;\n";
+    std::vector<glsl::parseJob> jobs(1);
+    jobs[0].source = source.data();
+    jobs[0].length = source.size();
+    jobs[0].type = glsl::astTU::kVertex;
+    jobs[0].fileName = "single";
+    glsl::parseBatch batch(8);
+    std::vector<glsl::parseResult> results;
+    batch.parse(jobs, results);
+    ASSERT_EQ(results.size(), 1u);
+    ASSERT_NE(results[0].ast, nullptr);
+    EXPECT_EQ(results[0].ast->globals.size(), 1u);
+    batch.parse(std::vector<glsl::parseJob>(), results);
+    EXPECT_TRUE(results.empty());
+}
+
+}
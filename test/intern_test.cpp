@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+#include "glslParser/intern.hpp"
+#include "glslParser/parser.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+TEST(Intern, EqualStringsShareOneCopy) {
+    glsl::internTable atoms;
+    const char source[] = "position position";
+    const char *first = atoms.intern(source, 8);
+    const char *second = atoms.intern(source + 9, 8);
+    EXPECT_EQ(first, second);
+    EXPECT_STREQ(first, "position");
+    EXPECT_NE(atoms.intern("pos", 3), first);
+    EXPECT_EQ(atoms.size(), 2u);
+}
+
+TEST(Intern, PointersStayStableAsTheTableGrows) {
+    glsl::internTable atoms;
+    std::vector<const char *> interned;
+    for (int i = 0; i < 5000; i++) {
+        const std::string name = "name" + std::to_string(i);
+        interned.push_back(atoms.intern(name.c_str(), name.size()));
+    }
+    EXPECT_EQ(atoms.size(), 5000u);
+    for (int i = 0; i < 5000; i++) {
+        const std::string name = "name" + std::to_string(i);
+        EXPECT_EQ(atoms.intern(name.c_str(), name.size()), interned[i]);
+    }
+}
+
+TEST(Intern, ConcurrentInterning) {
+    glsl::internTable atoms;
+    const int kThreads = 4;
+    const int kNames = 2000;
+    std::vector<std::vector<const char *>> results(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < kNames; i++) {
+                // Each thread walks the names in a different order
+                const int index = (i * (t + 1) * 7919) % kNames;
+                const std::string name = "n" + std::to_string(index);
+                results[t].push_back(atoms.intern(name.c_str(), name.size()));
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(atoms.size(), size_t(kNames));
+    for (int i = 0; i < kNames; i++) {
+        const std::string name = "n" + std::to_string(i);
+        const char *atom = atoms.intern(name.c_str(), name.size());
+        EXPECT_STREQ(atom, name.c_str());
+        for (int t = 0; t < kThreads; t++) {
+            const int index = (i * (t + 1) * 7919) % kNames;
+            const std::string expected = "n" + std::to_string(index);
+            EXPECT_STREQ(results[t][i], expected.c_str());
+        }
+    }
+}
+
+TEST(Intern, ParsersShareNames) {
+    const std::string first = "uniform vec4 color;\n";
+    const std::string second = "uniform vec4 color;\nuniform vec4 other;\n";
+    glsl::internTable atoms;
+    glsl::parser a(first.c_str(), first.size(), "a", nullptr, &atoms);
+    glsl::parser b(second.c_str(), second.size(), "b", nullptr, &atoms);
+    glsl::astTU *tuA = a.parse(glsl::astTU::kFragment);
+    glsl::astTU *tuB = b.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tuA, nullptr) << a.error();
+    ASSERT_NE(tuB, nullptr) << b.error();
+    EXPECT_EQ(tuA->globals[0]->name, tuB->globals[0]->name);
+    EXPECT_EQ(tuB->globals[1]->name, atoms.intern("other", 5));
+}
+
+}
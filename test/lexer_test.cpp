@@ -1,6 +1,7 @@
 #include "gtest/gtest.h"
 #include "glslParser/lexer.hpp"
 
+#include <limits.h>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -250,4 +251,263 @@ TEST(Lexer, SkipComment) {
     EXPECT_SCOPE_BEGIN()
     EXPECT_SCOPE_END()
 }
+
+TEST(Lexer, KeywordLikeIdentifiers) {
+    const std::string program = "vec vec5 int_ floats iimage2DMSArrays _struct in inout";
+    auto lex = glsl::lexer(program.c_str());
+    EXPECT_IDENTIFIER("vec")
+    EXPECT_IDENTIFIER("vec5")
+    EXPECT_IDENTIFIER("int_")
+    EXPECT_IDENTIFIER("floats")
+    EXPECT_IDENTIFIER("iimage2DMSArrays")
+    EXPECT_IDENTIFIER("_struct")
+    EXPECT_KEYWORD(in)
+    EXPECT_KEYWORD(inout)
+}
+
+TEST(Lexer, ZeroCopyIdentifiers) {
+    const std::string program = "float value = other_value;";
+    auto lex = glsl::lexer(program.c_str());
+    lex.setZeroCopy(true);
+    EXPECT_KEYWORD(float)
+    {
+        auto tok = lex.read();
+        EXPECT_EQ(tok.getType(), glsl::kType_identifier);
+        EXPECT_EQ(tok.getOffset(), 6u);
+        EXPECT_EQ(std::string(lex.identifier(tok), tok.getLength()), "value");
+    }
+    lex.read(); // '='
+    {
+        auto tok = lex.read();
+        EXPECT_EQ(tok.getType(), glsl::kType_identifier);
+        EXPECT_EQ(std::string(lex.identifier(tok), tok.getLength()), "other_value");
+    }
+}
+
+TEST(Lexer, PeekDoesNotConsume) {
+    const std::string program = "void main ( ) /* comment */ { }";
+    auto lex = glsl::lexer(program.c_str());
+    EXPECT_KEYWORD(void)
+    EXPECT_EQ(lex.peek().getType(), glsl::kType_identifier);
+    EXPECT_EQ(lex.peek(1).getAsOperator(), glsl::kOperator_paranthesis_begin);
+    EXPECT_EQ(lex.peek(3).getType(), glsl::kType_scope_begin);
+    EXPECT_IDENTIFIER("main")
+    EXPECT_PARENTHESIS_BEGIN()
+    EXPECT_EQ(lex.column(), 12u);
+    EXPECT_PARENTHESIS_END()
+    EXPECT_SCOPE_BEGIN()
+    EXPECT_SCOPE_END()
+    EXPECT_EQ(lex.peek().getType(), glsl::kType_eof);
+}
+
+TEST(Lexer, TokenizeWholeSource) {
+    const std::string program =
+        "// comment\n"
+        "int x = 1;\n"
+        "float y;\n";
+    auto lex = glsl::lexer(program.c_str());
+    glsl::tokenStream tokens;
+    lex.tokenize(tokens);
+    ASSERT_EQ(tokens.size(), 9u);
+    EXPECT_EQ(tokens.error(), nullptr);
+    EXPECT_EQ(tokens[0].getAsKeyword(), glsl::kKeyword_int);
+    EXPECT_EQ(tokens[1].getType(), glsl::kType_identifier);
+    EXPECT_EQ(tokens[1].getOffset(), 15u);
+    EXPECT_EQ(tokens[1].getLength(), 1u);
+    EXPECT_EQ(tokens[3].getAsInt(), 1);
+    EXPECT_EQ(tokens[4].getType(), glsl::kType_semicolon);
+    EXPECT_EQ(tokens.line(4), 2u);
+    EXPECT_EQ(tokens[5].getAsKeyword(), glsl::kKeyword_float);
+    EXPECT_EQ(tokens.line(5), 3u);
+    EXPECT_EQ(tokens[8].getType(), glsl::kType_eof);
+}
+
+TEST(Lexer, TokenizeStopsAtError) {
+    const std::string program = "int x = $;";
+    auto lex = glsl::lexer(program.c_str());
+    glsl::tokenStream tokens;
+    lex.tokenize(tokens);
+    ASSERT_EQ(tokens.size(), 4u);
+    EXPECT_NE(tokens.error(), nullptr);
+    EXPECT_EQ(tokens[3].getType(), glsl::kType_eof);
+    EXPECT_EQ(tokens[3].getOffset(), 8u);
+}
+
+TEST(Lexer, TokenizeSkipsBodies) {
+    const std::string program =
+        "void f() {\n"
+        "    // }\n"
+        "    if (a) { b; }\n"
+        "}\n"
+        "int x;\n";
+    auto lex = glsl::lexer(program.c_str());
+    glsl::tokenStream tokens;
+    lex.tokenize(tokens, true);
+    ASSERT_EQ(tokens.size(), 10u);
+    EXPECT_EQ(tokens[4].getType(), glsl::kType_scope_begin);
+    EXPECT_EQ(tokens[5].getType(), glsl::kType_scope_end);
+    EXPECT_EQ(tokens.line(5), 4u);
+    EXPECT_EQ(tokens[6].getAsKeyword(), glsl::kKeyword_int);
+    EXPECT_EQ(tokens.line(6), 5u);
+
+    glsl::tokenStream body;
+    lex.tokenizeBody(body, tokens[4].getOffset(), tokens.line(4));
+    ASSERT_EQ(body.size(), 11u);
+    EXPECT_EQ(body[0].getType(), glsl::kType_scope_begin);
+    EXPECT_EQ(body[1].getAsKeyword(), glsl::kKeyword_if);
+    EXPECT_EQ(body.line(1), 3u);
+    EXPECT_EQ(body[9].getType(), glsl::kType_scope_end);
+    EXPECT_EQ(body.line(9), 4u);
+    EXPECT_EQ(body[10].getType(), glsl::kType_eof);
+}
+
+TEST(Lexer, RejectsSourcesOf4GiB) {
+    if (sizeof(size_t) <= 4)
+        GTEST_SKIP();
+    // Only the first token is ever read
+    const std::string program = "x;";
+    const size_t length = size_t(UINT_MAX) + 1;
+    auto lex = glsl::lexer(program.c_str(), length);
+    glsl::tokenStream tokens;
+    lex.tokenize(tokens);
+    ASSERT_EQ(tokens.size(), 1u);
+    EXPECT_EQ(tokens[0].getType(), glsl::kType_eof);
+    ASSERT_NE(tokens.error(), nullptr);
+    EXPECT_NE(std::string(tokens.error()).find("4 GiB"), std::string::npos);
+
+    lex.reset(program.c_str(), program.size());
+    lex.tokenize(tokens);
+    EXPECT_EQ(tokens.error(), nullptr);
+    lex.reset(program.c_str(), length);
+    EXPECT_NE(lex.error(), nullptr);
+}
+
+TEST(Lexer, SkipLongWhitespaceAndComments) {
+    const std::string program =
+        "int" + std::string(40, ' ') + "\n\n" + std::string(37, '\t') + "a\n"
+        "// " + std::string(70, '-') + "\n"
+        "/*/ " + std::string(50, '*') + "\n" + std::string(20, ' ') + "\n**/ b" + std::string(90, ' ');
+    auto lex = glsl::lexer(program.c_str());
+    glsl::tokenStream tokens;
+    lex.tokenize(tokens);
+    ASSERT_EQ(tokens.size(), 4u);
+    EXPECT_EQ(tokens.error(), nullptr);
+    EXPECT_EQ(tokens.line(0), 1u);
+    EXPECT_EQ(tokens[1].getType(), glsl::kType_identifier);
+    EXPECT_EQ(tokens.line(1), 3u);
+    EXPECT_EQ(tokens[2].getType(), glsl::kType_identifier);
+    EXPECT_EQ(tokens.line(2), 7u);
+    EXPECT_EQ(tokens[3].getType(), glsl::kType_eof);
+    EXPECT_EQ(lex.line(), 7u);
+    EXPECT_EQ(lex.column(), 96u);
+}
+
+TEST(Lexer, NumericLiterals) {
+    const std::string program =
+        "42 42u 0x2A 0XffffffffU 052 0 1.5 .25 2. 1e3 1.0e+2 25E-2f "
+        "0.1 3.14159265358979lf 1.7976931348623157e308lf 0.333333333333333333333333f";
+    auto lex = glsl::lexer(program.c_str());
+    auto tok = lex.read();
+    EXPECT_EQ(tok.getType(), glsl::kType_constant_int);
+    EXPECT_EQ(tok.getAsInt(), 42);
+    tok = lex.read();
+    EXPECT_EQ(tok.getType(), glsl::kType_constant_uint);
+    EXPECT_EQ(tok.getAsUnsigned(), 42u);
+    EXPECT_EQ(lex.read().getAsInt(), 42);
+    EXPECT_EQ(lex.read().getAsUnsigned(), 0xffffffffu);
+    EXPECT_EQ(lex.read().getAsInt(), 42);
+    EXPECT_EQ(lex.read().getAsInt(), 0);
+    const float floats[] = { 1.5f, 0.25f, 2.0f, 1000.0f, 100.0f, 0.25f, 0.1f };
+    for (size_t i = 0; i < sizeof floats / sizeof *floats; i++) {
+        tok = lex.read();
+        EXPECT_EQ(tok.getType(), glsl::kType_constant_float);
+        EXPECT_EQ(tok.getAsFloat(), floats[i]);
+    }
+    tok = lex.read();
+    EXPECT_EQ(tok.getType(), glsl::kType_constant_double);
+    EXPECT_EQ(tok.getAsDouble(), 3.14159265358979);
+    EXPECT_EQ(lex.read().getAsDouble(), 1.7976931348623157e308);
+    EXPECT_EQ(lex.read().getAsFloat(), 0.333333333333333333333333f);
+    EXPECT_EQ(lex.read().getType(), glsl::kType_eof);
+}
+
+TEST(Lexer, InvalidNumericLiterals) {
+    const char *const programs[] = { "09", "0x", "1e", "1.5u", "4294967296u", "2147483648", "0x1.0" };
+    for (size_t i = 0; i < sizeof programs / sizeof *programs; i++) {
+        auto lex = glsl::lexer(programs[i]);
+        lex.read();
+        EXPECT_NE(lex.error(), nullptr) << programs[i];
+    }
+}
+
+TEST(Lexer, LengthAwareInput) {
+    // Only the first ten bytes are source, the rest must never be looked at
+    const char program[] = { 'i', 'n', 't', ' ', 'x', ' ', '=', ' ', '1', '2', '3', '$' };
+    auto lex = glsl::lexer(program, 10);
+    EXPECT_KEYWORD(int)
+    EXPECT_IDENTIFIER("x")
+    lex.read(); // '='
+    auto tok = lex.read();
+    EXPECT_EQ(tok.getType(), glsl::kType_constant_int);
+    EXPECT_EQ(tok.getAsInt(), 12);
+    EXPECT_EQ(lex.read().getType(), glsl::kType_eof);
+    EXPECT_EQ(lex.error(), nullptr);
+}
+
+TEST(Lexer, PaddedInput) {
+    const std::string program =
+        "uniform vec4 _color_1; void main() { x <<= 0x1F + 07u * 1.5e-3f; } // end\n"
+        "ident";
+    std::string padded = program;
+    padded.append(glsl::lexer::kPadding, '\0');
+
+    auto plain = glsl::lexer(program.c_str(), program.size());
+    auto lex = glsl::lexer(padded.data(), program.size());
+    lex.setPadded(true);
+    glsl::tokenStream expected;
+    glsl::tokenStream tokens;
+    plain.tokenize(expected);
+    lex.tokenize(tokens);
+    ASSERT_EQ(tokens.size(), expected.size());
+    EXPECT_EQ(tokens.error(), nullptr);
+    for (size_t i = 0; i < tokens.size(); i++) {
+        EXPECT_EQ(tokens[i].getType(), expected[i].getType());
+        EXPECT_EQ(tokens[i].getOffset(), expected[i].getOffset());
+        EXPECT_EQ(tokens[i].getLength(), expected[i].getLength());
+    }
+    EXPECT_EQ(tokens[tokens.size() - 2].getLength(), 5u);
+}
+
+TEST(Lexer, AllOperators) {
+    #undef OPERATOR
+    #define OPERATOR(name, string, precedence) { string, glsl::kOperator_##name },
+    const std::vector<std::pair<std::string, int>> operators = {
+        #include "glslParser/lexemes.hpp"
+    };
+    #undef OPERATOR
+    #define OPERATOR(...)
+
+    std::string program;
+    for (auto &op : operators)
+        program += op.first + " ";
+    // Operators run together lex as the longest match
+    program += "a<<=b>>c&&=d";
+
+    auto lex = glsl::lexer(program.c_str());
+    for (auto &op : operators) {
+        auto tok = lex.read();
+        EXPECT_EQ(tok.getType(), glsl::kType_operator) << op.first;
+        EXPECT_EQ(tok.getAsOperator(), op.second) << op.first;
+        EXPECT_EQ(tok.getLength(), op.first.size()) << op.first;
+    }
+    EXPECT_IDENTIFIER("a")
+    EXPECT_EQ(lex.read().getAsOperator(), glsl::kOperator_shift_left_assign);
+    EXPECT_IDENTIFIER("b")
+    EXPECT_EQ(lex.read().getAsOperator(), glsl::kOperator_shift_right);
+    EXPECT_IDENTIFIER("c")
+    EXPECT_EQ(lex.read().getAsOperator(), glsl::kOperator_logical_and);
+    EXPECT_EQ(lex.read().getAsOperator(), glsl::kOperator_assign);
+    EXPECT_IDENTIFIER("d")
+    EXPECT_EQ(lex.read().getType(), glsl::kType_eof);
+}
 }
@@ -0,0 +1,550 @@
+#include "gtest/gtest.h"
+#include "glslParser/parser.hpp"
+
+#include <limits.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+glsl::astVariable *referenced(glsl::astFunction *function, size_t index) {
+    auto statement = (glsl::astExpressionStatement *)function->statements[index];
+    EXPECT_EQ(statement->type, glsl::astStatement::kExpression);
+    EXPECT_EQ(statement->expression->type, glsl::astExpression::kVariableIdentifier);
+    return ((glsl::astVariableIdentifier *)statement->expression)->variable;
+}
+
+// An expression with every operation in parentheses
+std::string describe(glsl::astExpression *expression) {
+    switch (expression->type) {
+    case glsl::astExpression::kVariableIdentifier:
+        return ((glsl::astVariableIdentifier *)expression)->variable->name;
+    case glsl::astExpression::kUnaryMinus:
+        return "-" + describe(((glsl::astUnaryExpression *)expression)->operand);
+    case glsl::astExpression::kLogicalNot:
+        return "!" + describe(((glsl::astUnaryExpression *)expression)->operand);
+    case glsl::astExpression::kTernary: {
+        auto ternary = (glsl::astTernaryExpression *)expression;
+        return "(" + describe(ternary->condition) + "?" + describe(ternary->onTrue) + ":" + describe(ternary->onFalse) + ")";
+    }
+    case glsl::astExpression::kAssign:
+    case glsl::astExpression::kOperation: {
+        auto binary = (glsl::astBinaryExpression *)expression;
+        std::string operation = "=";
+        if (expression->type == glsl::astExpression::kOperation) {
+            switch (((glsl::astOperationExpression *)expression)->operation) {
+            case glsl::kOperator_plus: operation = "+"; break;
+            case glsl::kOperator_minus: operation = "-"; break;
+            case glsl::kOperator_multiply: operation = "*"; break;
+            case glsl::kOperator_divide: operation = "/"; break;
+            case glsl::kOperator_logical_and: operation = "&&"; break;
+            case glsl::kOperator_logical_or: operation = "||"; break;
+            default: operation = "?"; break;
+            }
+        }
+        return "(" + describe(binary->operand1) + operation + describe(binary->operand2) + ")";
+    }
+    }
+    return "?";
+}
+
+TEST(Parser, SymbolTableScopes) {
+    glsl::astVariable outer(glsl::astVariable::kGlobal);
+    glsl::astVariable inner(glsl::astVariable::kParameter);
+    glsl::astVariable again(glsl::astVariable::kGlobal);
+    char name[] = "x";
+    outer.name = inner.name = again.name = name;
+
+    glsl::symbolTable symbols;
+    EXPECT_EQ(symbols.find(name), nullptr);
+    symbols.push();
+    symbols.add(&outer);
+    symbols.add(&again); // Redeclared, the first one stays visible
+    EXPECT_EQ(symbols.find(name), &outer);
+    symbols.push();
+    symbols.add(&inner);
+    EXPECT_EQ(symbols.find(name), &inner);
+    symbols.pop();
+    EXPECT_EQ(symbols.find(name), &outer);
+    symbols.pop();
+    EXPECT_EQ(symbols.find(name), nullptr);
+}
+
+TEST(Parser, VariableLookupFollowsScopes) {
+    const std::string source =
+        "float x;\n"
+        "float y;\n"
+        "void f(float x) { x; y; }\n"
+        "void g() { x; }\n";
+    glsl::parser p(source.c_str(), "scopes");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    ASSERT_EQ(tu->functions.size(), 2u);
+    EXPECT_EQ(referenced(tu->functions[0], 0), tu->functions[0]->parameters[0]);
+    EXPECT_EQ(referenced(tu->functions[0], 1), tu->globals[1]);
+    EXPECT_EQ(referenced(tu->functions[1], 0), tu->globals[0]);
+}
+
+TEST(Parser, UndeclaredVariable) {
+    const std::string source = "void f(float x) { }\nvoid g() { x; }\n";
+    glsl::parser p(source.c_str(), "undeclared");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(p.error()).find("not declared"), std::string::npos);
+}
+
+
+TEST(Parser, StructTypeAndFieldLookup) {
+    std::string source = "struct material {\n";
+    for (int i = 0; i < 64; i++)
+        source += "    vec4 field" + std::to_string(i) + ";\n";
+    source += "};\n"
+        "struct light { vec3 color; };\n"
+        "material m;\n"
+        "light l;\n"
+        "void main() { m.field63; l.color; m.field0; }\n";
+    glsl::parser p(source.c_str(), "structs");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    ASSERT_EQ(tu->structures.size(), 2u);
+    EXPECT_EQ(tu->globals[0]->baseType, tu->structures[0]);
+    EXPECT_EQ(tu->globals[1]->baseType, tu->structures[1]);
+    glsl::astStruct *material = tu->structures[0];
+    EXPECT_EQ(material->findField(material->fields[17]->name), material->fields[17]);
+    EXPECT_EQ(material->findField(tu->structures[1]->fields[0]->name), nullptr);
+    // Names which the parser did not intern are found by their contents
+    std::string field = "field42";
+    EXPECT_EQ(material->findField(field.c_str()), material->fields[42]);
+    EXPECT_EQ(material->findField("field64"), nullptr);
+}
+
+TEST(Parser, MissingStructField) {
+    const std::string source =
+        "struct light { vec3 color; };\n"
+        "light l;\n"
+        "void main() { l.colour; }\n";
+    glsl::parser p(source.c_str(), "fields");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(p.error()).find("field `colour' does not exist"), std::string::npos);
+}
+TEST(Parser, ConcurrentParsesKeepTheirLines) {
+    // Each thread parses a source with its functions at different lines
+    const int kThreads = 4;
+    std::vector<int> mismatches(kThreads, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&mismatches, t]() {
+            std::string source(t * 10, '\n');
+            for (int i = 0; i < 32; i++)
+                source += "float f" + std::to_string(i) + "() { return 1.0; }\n";
+            for (int pass = 0; pass < 20; pass++) {
+                glsl::parser p(source.c_str(), "lines");
+                glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+                if (!tu || tu->functions.size() != 32) {
+                    mismatches[t]++;
+                    continue;
+                }
+                for (int i = 0; i < 32; i++) {
+                    glsl::astFunction *function = tu->functions[i];
+                    const int line = t * 10 + i + 1;
+                    if (function->line != line || function->statements[0]->line != line)
+                        mismatches[t]++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    for (int t = 0; t < kThreads; t++)
+        EXPECT_EQ(mismatches[t], 0) << "thread " << t;
+}
+
+TEST(Parser, ResetParsesAnotherSource) {
+    const std::string sources[] = {
+        "struct light { vec3 color; };\nlight l;\nvoid main() { l.color; }\n",
+        "void main() { undefined; }\n",
+        "uniform vec4 a;\nuniform vec4 b;\nvoid main() { a; b; }\n"
+    };
+    glsl::parser p("", 0, "empty");
+    for (int pass = 0; pass < 3; pass++) {
+        p.reset(sources[0].data(), sources[0].size(), "first");
+        glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+        ASSERT_NE(tu, nullptr) << p.error();
+        ASSERT_EQ(tu->structures.size(), 1u);
+        EXPECT_EQ(tu->globals[0]->baseType, tu->structures[0]);
+
+        p.reset(sources[1].data(), sources[1].size(), "second");
+        EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+        EXPECT_EQ(std::string(p.error()).find("second:1:"), 0u);
+
+        // Nothing from the first source is left in scope
+        p.reset(sources[2].data(), sources[2].size(), "third");
+        tu = p.parse(glsl::astTU::kFragment);
+        ASSERT_NE(tu, nullptr) << p.error();
+        EXPECT_TRUE(tu->structures.empty());
+        ASSERT_EQ(tu->globals.size(), 2u);
+        EXPECT_EQ(referenced(tu->functions[0], 1), tu->globals[1]);
+        EXPECT_EQ(tu->functions[0]->line, 3);
+    }
+}
+
+TEST(Parser, BuiltinsFollowTheStage) {
+    const std::string vertex = "void main() { gl_Position; gl_VertexID; }\n";
+    const std::string fragment = "void main() { gl_FragCoord; gl_MaxDrawBuffers; }\n";
+    glsl::parser v(vertex.c_str(), "vertex");
+    glsl::astTU *tu = v.parse(glsl::astTU::kVertex);
+    ASSERT_NE(tu, nullptr) << v.error();
+    const glsl::prelude &prelude = glsl::prelude::get(glsl::astTU::kVertex);
+    EXPECT_EQ(referenced(tu->functions[0], 0), prelude.find("gl_Position", 11));
+
+    glsl::parser f(fragment.c_str(), "fragment");
+    tu = f.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << f.error();
+    auto limit = (glsl::astGlobalVariable *)referenced(tu->functions[0], 1);
+    EXPECT_EQ(limit->storage, glsl::kConst);
+    ASSERT_NE(limit->initialValue, nullptr);
+    EXPECT_EQ(((glsl::astIntConstant *)limit->initialValue)->value, 8);
+
+    // Every parser of a stage shares its prelude, others don't see it
+    glsl::parser wrongStage(vertex.c_str(), "wrong");
+    EXPECT_EQ(wrongStage.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_EQ(&glsl::prelude::get(glsl::astTU::kVertex), &prelude);
+    EXPECT_EQ(prelude.find("gl_FragCoord", 12), nullptr);
+}
+
+TEST(Parser, DeclarationsHideBuiltins) {
+    const std::string source =
+        "float gl_PointSize;\n"
+        "void main() { gl_PointSize; }\n";
+    glsl::parser p(source.c_str(), "shadow");
+    glsl::astTU *tu = p.parse(glsl::astTU::kVertex);
+    ASSERT_NE(tu, nullptr) << p.error();
+    EXPECT_EQ(referenced(tu->functions[0], 0), tu->globals[0]);
+}
+
+TEST(Parser, BuiltinTypesAreShared) {
+    const std::string source = "uniform vec4 a;\nuniform float b;\nvec4 f(vec4 c) { return c; }\n";
+    glsl::parser first(source.c_str(), "first");
+    glsl::parser second(source.c_str(), "second");
+    glsl::astTU *one = first.parse(glsl::astTU::kFragment);
+    glsl::astTU *two = second.parse(glsl::astTU::kFragment);
+    ASSERT_NE(one, nullptr) << first.error();
+    ASSERT_NE(two, nullptr) << second.error();
+    glsl::astBuiltin *vec4 = glsl::astBuiltin::get(glsl::kKeyword_vec4);
+    EXPECT_EQ(vec4->type, glsl::kKeyword_vec4);
+    EXPECT_EQ(one->globals[0]->baseType, vec4);
+    EXPECT_EQ(two->globals[0]->baseType, vec4);
+    EXPECT_EQ(one->functions[0]->returnType, vec4);
+    EXPECT_EQ(one->functions[0]->parameters[0]->baseType, vec4);
+    EXPECT_EQ(two->globals[1]->baseType, glsl::astBuiltin::get(glsl::kKeyword_float));
+}
+
+TEST(Parser, LayoutQualifierIds) {
+    const std::string source =
+        "layout(location = 2, component = 1) out vec4 color;\n"
+        "layout(std140, shared, row_major, binding = 3) uniform mat4 transform;\n";
+    glsl::parser p(source.c_str(), "layout");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    const glsl::astArray<glsl::astLayoutQualifier*> &first = tu->globals[0]->layoutQualifiers;
+    ASSERT_EQ(first.size(), 2u);
+    EXPECT_EQ(first[0]->id, glsl::kLayout_location);
+    EXPECT_EQ(first[1]->id, glsl::kLayout_component);
+    const glsl::astArray<glsl::astLayoutQualifier*> &second = tu->globals[1]->layoutQualifiers;
+    ASSERT_EQ(second.size(), 4u);
+    EXPECT_EQ(second[0]->id, glsl::kLayout_std140);
+    EXPECT_EQ(second[1]->id, glsl::kLayout_shared);
+    EXPECT_EQ(second[2]->id, glsl::kLayout_row_major);
+    EXPECT_EQ(second[3]->id, glsl::kLayout_binding);
+    EXPECT_STREQ(second[1]->name, "shared");
+}
+
+TEST(Parser, UnknownLayoutQualifier) {
+    const std::string source = "layout(std14) uniform mat4 transform;\n";
+    glsl::parser p(source.c_str(), "layout");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(p.error()).find("unknown layout qualifier `std14'"), std::string::npos);
+}
+
+TEST(Parser, ConstantFolding) {
+    const std::string source =
+        "const int n = 2 + 3;\n"
+        "const int m = n * 2;\n"
+        "layout(location = n) out vec4 color;\n"
+        "layout(location = m - 1) out vec4 depth;\n";
+    glsl::parser p(source.c_str(), "fold");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    glsl::astConstantExpression *n = tu->globals[0]->initialValue;
+    ASSERT_EQ(n->type, glsl::astExpression::kIntConstant);
+    EXPECT_EQ(((glsl::astIntConstant *)n)->value, 5);
+    glsl::astConstantExpression *m = tu->globals[1]->initialValue;
+    ASSERT_EQ(m->type, glsl::astExpression::kIntConstant);
+    EXPECT_EQ(((glsl::astIntConstant *)m)->value, 10);
+    // A reference to a constant folds to its value without a new node
+    EXPECT_EQ(tu->globals[2]->layoutQualifiers[0]->initialValue, n);
+    glsl::astConstantExpression *location = tu->globals[3]->layoutQualifiers[0]->initialValue;
+    ASSERT_EQ(location->type, glsl::astExpression::kIntConstant);
+    EXPECT_EQ(((glsl::astIntConstant *)location)->value, 9);
+}
+
+TEST(Parser, ConstantFoldingErrors) {
+    const std::string notConstant = "uniform int u;\nlayout(location = u + 1) out vec4 color;\n";
+    glsl::parser p(notConstant.c_str(), "fold");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(p.error()).find("not a valid constant expression"), std::string::npos);
+
+    const std::string duplicate =
+        "const int n = 2 + 3;\n"
+        "void main() { switch (1) { case n: break; case 5: break; } }\n";
+    glsl::parser q(duplicate.c_str(), "fold");
+    EXPECT_EQ(q.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(q.error()).find("duplicate case label `5'"), std::string::npos);
+}
+
+TEST(Parser, DeclarationOrExpression) {
+    const std::string source =
+        "struct light { vec3 color; };\n"
+        "void main() {\n"
+        "    float a = 1.0;\n"
+        "    vec4(1.0);\n"
+        "    light l;\n"
+        "    const float (b) = 2.0, c;\n"
+        "    a = b;\n"
+        "    l;\n"
+        "}\n";
+    glsl::parser p(source.c_str(), "statements");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    const glsl::astArray<glsl::astStatement*> &statements = tu->functions[0]->statements;
+    ASSERT_EQ(statements.size(), 6u);
+    const int expected[] = {
+        glsl::astStatement::kDeclaration,
+        glsl::astStatement::kExpression,
+        glsl::astStatement::kDeclaration,
+        glsl::astStatement::kDeclaration,
+        glsl::astStatement::kExpression,
+        glsl::astStatement::kExpression
+    };
+    for (size_t i = 0; i < statements.size(); i++)
+        EXPECT_EQ(statements[i]->type, expected[i]) << "statement " << i;
+    auto constants = (glsl::astDeclarationStatement *)statements[3];
+    ASSERT_EQ(constants->variables.size(), 2u);
+    EXPECT_TRUE(((glsl::astFunctionVariable *)constants->variables[1])->isConst);
+    EXPECT_EQ(referenced(tu->functions[0], 5), ((glsl::astDeclarationStatement *)statements[2])->variables[0]);
+
+    const std::string broken = "void main() { float a, 5; }\n";
+    glsl::parser q(broken.c_str(), "broken");
+    EXPECT_EQ(q.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(q.error()).find("expected name in declaration"), std::string::npos);
+}
+
+TEST(Parser, OperatorPrecedence) {
+    const std::string source =
+        "void main() {\n"
+        "    float a = 1.0; float b = 2.0; float c = 3.0; bool p = true; bool q = false;\n"
+        "    a = b + c * a - b / c;\n"
+        "    a = (b + c) * (a - b);\n"
+        "    p = p || q && !p;\n"
+        "    a = p ? b : q ? c : a;\n"
+        "    a = -(p ? b : c) * -a;\n"
+        "}\n";
+    glsl::parser p(source.c_str(), "precedence");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    const glsl::astArray<glsl::astStatement*> &statements = tu->functions[0]->statements;
+    ASSERT_EQ(statements.size(), 10u);
+    const char *expected[] = {
+        "(a=((b+(c*a))-(b/c)))",
+        "(a=((b+c)*(a-b)))",
+        "(p=(p||(q&&!p)))",
+        "(a=(p?b:(q?c:a)))",
+        "(a=(-(p?b:c)*-a))"
+    };
+    for (size_t i = 0; i < 5; i++)
+        EXPECT_EQ(describe(((glsl::astExpressionStatement *)statements[5 + i])->expression), expected[i]);
+}
+
+TEST(Parser, DeepExpressions) {
+    // Far deeper than the native stack would allow one frame per level
+    const size_t depth = 50000;
+    std::string source = "void main() { float a = 1.0; a = ";
+    for (size_t i = 0; i < depth; i++)
+        source += "-(";
+    source += "a";
+    for (size_t i = 0; i < depth; i++)
+        source += " + a)";
+    source += "; }\n";
+    glsl::parser p(source.c_str(), "deep");
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    auto assign = (glsl::astBinaryExpression *)((glsl::astExpressionStatement *)tu->functions[0]->statements[1])->expression;
+    ASSERT_EQ(assign->type, glsl::astExpression::kAssign);
+    glsl::astExpression *expression = assign->operand2;
+    for (size_t i = 0; i < depth; i++) {
+        ASSERT_EQ(expression->type, glsl::astExpression::kUnaryMinus);
+        expression = ((glsl::astUnaryExpression *)expression)->operand;
+        ASSERT_EQ(expression->type, glsl::astExpression::kOperation);
+        expression = ((glsl::astBinaryExpression *)expression)->operand1;
+    }
+    EXPECT_EQ(expression->type, glsl::astExpression::kVariableIdentifier);
+}
+
+TEST(Parser, LazyBodies) {
+    const std::string source =
+        "uniform float scale;\n"
+        "float f(float x) { return x * scale; }\n"
+        "float g(float x) {\n"
+        "    /* } */ x += 1.0;\n"
+        "    return later;\n"
+        "}\n"
+        "float later;\n"
+        "void main() { { f(1.0); } }\n";
+    glsl::parser p(source.c_str(), "lazy");
+    p.setLazyBodies(true);
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    ASSERT_EQ(tu->functions.size(), 3u);
+    for (size_t i = 0; i < 3; i++) {
+        glsl::astFunction *function = tu->functions[i];
+        EXPECT_TRUE(function->isDeferred);
+        EXPECT_EQ(function->statements.size(), 0u);
+        EXPECT_EQ(source[function->bodyOffset], '{');
+        EXPECT_EQ(source[function->bodyOffset + function->bodyLength - 1], '}');
+    }
+    EXPECT_EQ(source.substr(tu->functions[0]->bodyOffset, tu->functions[0]->bodyLength), "{ return x * scale; }");
+
+    // In any order and only once
+    ASSERT_TRUE(p.parseBody(tu->functions[2])) << p.error();
+    EXPECT_EQ(tu->functions[2]->statements.size(), 1u);
+    ASSERT_TRUE(p.parseBody(tu->functions[0])) << p.error();
+    ASSERT_TRUE(p.parseBody(tu->functions[0])) << p.error();
+    EXPECT_FALSE(tu->functions[0]->isDeferred);
+    EXPECT_EQ(tu->functions[0]->statements.size(), 1u);
+
+    // `later' is declared after g so it is not in scope there
+    EXPECT_FALSE(p.parseBody(tu->functions[1]));
+    EXPECT_NE(std::string(p.error()).find("lazy:5:"), std::string::npos) << p.error();
+    EXPECT_NE(std::string(p.error()).find("`later'"), std::string::npos) << p.error();
+    EXPECT_TRUE(tu->functions[1]->isDeferred);
+}
+
+TEST(Parser, LazyBodiesAfterLexerError) {
+    const std::string source =
+        "float f(float x) {\n"
+        "    return x @ 2.0;\n"
+        "}\n"
+        "float g(float x) { return x; }\n";
+    glsl::parser p(source.c_str(), "x");
+    p.setLazyBodies(true);
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    ASSERT_EQ(tu->functions.size(), 2u);
+    EXPECT_FALSE(p.parseBody(tu->functions[0]));
+    EXPECT_STREQ(p.error(), "x:2:14: error: invalid character encountered");
+    // The error stays with the body it was found in
+    ASSERT_TRUE(p.parseBody(tu->functions[1])) << p.error();
+    EXPECT_EQ(tu->functions[1]->statements.size(), 1u);
+}
+
+TEST(Parser, LazyBodyRetried) {
+    const std::string source = "float f() { float a = 1.0; return b; }\n";
+    glsl::parser p(source.c_str(), "retry");
+    p.setLazyBodies(true);
+    glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+    ASSERT_NE(tu, nullptr) << p.error();
+    for (int attempt = 0; attempt < 3; attempt++) {
+        EXPECT_FALSE(p.parseBody(tu->functions[0]));
+        EXPECT_TRUE(tu->functions[0]->isDeferred);
+        EXPECT_EQ(tu->functions[0]->statements.size(), 0u);
+    }
+}
+
+TEST(Parser, ParallelBodies) {
+    // Every body refers to the global just before it and one from earlier
+    std::string source = "float g0;\n";
+    for (size_t i = 1; i <= 200; i++) {
+        const std::string n = std::to_string(i);
+        source += "float g" + n + ";\n";
+        source += "float f" + n + "(float x) {\n"
+            "    x = g" + n + " * x;\n"
+            "    { x = x + g" + std::to_string(i / 2) + "; }\n"
+            "    return x;\n"
+            "}\n";
+    }
+    glsl::parser eager(source.c_str(), "parallel");
+    glsl::astTU *expected = eager.parse(glsl::astTU::kFragment);
+    ASSERT_NE(expected, nullptr) << eager.error();
+
+    glsl::parser p(source.c_str(), "parallel");
+    p.setBodyThreads(4);
+    // Again with the workers of the first pass
+    for (int pass = 0; pass < 2; pass++) {
+        p.reset(source.c_str(), source.size(), "parallel");
+        glsl::astTU *tu = p.parse(glsl::astTU::kFragment);
+        ASSERT_NE(tu, nullptr) << p.error();
+        ASSERT_EQ(tu->functions.size(), expected->functions.size());
+        for (size_t i = 0; i < tu->functions.size(); i++) {
+            glsl::astFunction *function = tu->functions[i];
+            EXPECT_FALSE(function->isDeferred);
+            ASSERT_EQ(function->statements.size(), 3u);
+            auto assign = (glsl::astExpressionStatement *)function->statements[0];
+            auto compound = (glsl::astCompoundStatement *)function->statements[1];
+            auto reference = (glsl::astExpressionStatement *)expected->functions[i]->statements[0];
+            ASSERT_EQ(compound->type, glsl::astStatement::kCompound);
+            EXPECT_EQ(describe(assign->expression), describe(reference->expression));
+            EXPECT_EQ(((glsl::astVariableIdentifier *)((glsl::astBinaryExpression *)
+                ((glsl::astBinaryExpression *)assign->expression)->operand2)->operand1)->variable, tu->globals[i + 1]);
+        }
+    }
+
+    // The first error in source order is the one reported, even when the top
+    // level fails further on
+    std::string broken = source;
+    broken.replace(broken.find("x = g150 * x;"), 13, "x = g151 * x;");
+    broken.replace(broken.find("x = g40 * x;"), 12, "x = g40 * ;  ");
+    broken += "float broken(;\n";
+    glsl::parser reference(broken.c_str(), "parallel");
+    ASSERT_EQ(reference.parse(glsl::astTU::kFragment), nullptr);
+    p.reset(broken.c_str(), broken.size(), "parallel");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_STREQ(p.error(), reference.error());
+}
+
+TEST(Parser, ParallelBodiesReuseMemory) {
+    std::string source;
+    for (size_t i = 0; i < 200; i++) {
+        const std::string n = std::to_string(i);
+        source += "float g" + n + ";\n";
+        source += "float f" + n + "(float x) { x = g" + n + " * x; return x; }\n";
+    }
+    // The arena takes over the nodes the workers made on every parse, yet
+    // settles like it does for any other repeated work
+    glsl::arena memory;
+    glsl::parser p(source.c_str(), source.size(), "reuse", &memory);
+    p.setBodyThreads(4);
+    size_t settled = 0;
+    for (int pass = 0; pass < 16; pass++) {
+        memory.reset();
+        p.reset(source.c_str(), source.size(), "reuse");
+        ASSERT_NE(p.parse(glsl::astTU::kFragment), nullptr) << p.error();
+        if (pass == 2) {
+            settled = memory.capacity();
+        } else if (pass > 2) {
+            EXPECT_LE(memory.capacity(), settled + settled / 4);
+        }
+    }
+}
+
+TEST(Parser, RejectsSourcesOf4GiB) {
+    if (sizeof(size_t) <= 4)
+        GTEST_SKIP();
+    const std::string source = "float x;";
+    glsl::parser p(source.c_str(), size_t(UINT_MAX) + 1, "huge");
+    EXPECT_EQ(p.parse(glsl::astTU::kFragment), nullptr);
+    EXPECT_NE(std::string(p.error()).find("4 GiB"), std::string::npos) << p.error();
+    p.reset(source.c_str(), source.size(), "huge");
+    EXPECT_NE(p.parse(glsl::astTU::kFragment), nullptr) << p.error();
+}
+
+}